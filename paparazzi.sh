@@ -8,11 +8,11 @@ DIST="UNKNOWN"
 
 # Dependencies
 DEPS_COMMON="cmake " 
-DEPS_LINUX_COMMON="libcurl4-openssl-dev uuid-dev libtool pkg-config build-essential autoconf automake lcov libzmq3-dev"
+DEPS_LINUX_COMMON="libcurl4-openssl-dev uuid-dev libtool pkg-config build-essential autoconf automake lcov libzmq3-dev zlib1g-dev libjpeg-dev libwebp-dev libsqlite3-dev"
 DEPS_LINUX_RASPBIAN="curl libfontconfig1-dev"
-DEPS_LINUX_UBUNTU="xorg-dev libgl1-mesa-dev "
-DEPS_LINUX_REDHAT="libX*-devel mesa-libGL-devel curl-devel glx-utils git libmpc-devel mpfr-devel gmp-devel"
-DEPS_DARWIN="glfw3 pkg-config zeromq autoconfig automake libtool zeromq"
+DEPS_LINUX_UBUNTU="xorg-dev libgl1-mesa-dev libegl1-mesa-dev libosmesa6-dev "
+DEPS_LINUX_REDHAT="libX*-devel mesa-libGL-devel curl-devel zlib-devel libjpeg-turbo-devel libwebp-devel sqlite-devel glx-utils git libmpc-devel mpfr-devel gmp-devel"
+DEPS_DARWIN="glfw3 pkg-config zeromq autoconfig automake libtool zeromq jpeg webp sqlite"
 
 # Compiling
 CMAKE_ARG=""
@@ -162,12 +162,6 @@ case "$1" in
             cp tangram-es/scenes/fonts fonts
         fi
 
-        # Other needed files/folders
-        if [ ! -d cache ]; then
-            echo "Creating cache folder"
-            mkdir cache
-        fi
-
         $0 make all
         ;;
 
@@ -189,6 +183,11 @@ case "$1" in
                 CMAKE_ARG="-DPLATFORM_TARGET=rpi"
             fi
 
+            # HEADLESS=egl or HEADLESS=osmesa renders without an X server
+            if [ -n "$HEADLESS" ]; then
+                CMAKE_ARG="$CMAKE_ARG -DHEADLESS=$HEADLESS"
+            fi
+
         elif [ $OS == "Darwin" ]; then
             echo "Preparing CMAKE for Darwin"
             N_CORES="4"
@@ -225,6 +224,18 @@ case "$1" in
         fi        
         ;;
 
+    test)
+        if [ ! -d worker/build ]; then
+            $0 make worker
+        fi
+        cd worker/build
+        make -j $(grep -c ^processor /proc/cpuinfo 2>/dev/null || echo 4)
+        ctest --output-on-failure
+        cd ../../proxy
+        make test
+        cd ..
+        ;;
+
     clean)
         if [ -d worker/build ]; then
             rm -rf worker/build
@@ -252,7 +263,7 @@ case "$1" in
         paparazzi_proxy ipc:///tmp/proxy_in ipc:///tmp/proxy_out &> proxy.log &
         
         # Is important to attach the threads to the display on the Amazon servers 
-        if [ "$DIST" == "Amazon Linux AMI" ]; then
+        if [ "$DIST" == "Amazon Linux AMI" ] && [ -z "$HEADLESS" ]; then
             export DISPLAY=:0
         fi
 
@@ -0,0 +1,255 @@
+#include "router.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "hash.h"    // shared with the workers
+
+#define LOAD_DECAY 0.99         // weight of the past jobs on the load of a worker (about 100 jobs window)
+#define WORKER_EXPIRATION 300   // seconds without a heartbeat before a worker leaves the ring
+
+static int fromHex(char _c) {
+    if (_c >= '0' && _c <= '9') return _c - '0';
+    if (_c >= 'a' && _c <= 'f') return _c - 'a' + 10;
+    if (_c >= 'A' && _c <= 'F') return _c - 'A' + 10;
+    return -1;
+}
+
+static std::string urlDecode(const char* _begin, const char* _end) {
+    std::string out;
+    out.reserve(_end - _begin);
+    for (const char* c = _begin; c < _end; c++) {
+        if (*c == '%' && _end - c > 2 && fromHex(c[1]) >= 0 && fromHex(c[2]) >= 0) {
+            out += char(fromHex(c[1]) * 16 + fromHex(c[2]));
+            c += 2;
+        } else if (*c == '+') {
+            out += ' ';
+        } else {
+            out += *c;
+        }
+    }
+    return out;
+}
+
+static bool hasScene(const std::vector<uint64_t> &_scenes, uint64_t _scene) {
+    return std::find(_scenes.begin(), _scenes.end(), _scene) != _scenes.end();
+}
+
+Router::Router(int _replicas, double _balance) : m_job(0), m_replicas(std::max(1, _replicas)), m_balance(_balance), m_total_load(0.0) {
+}
+
+std::string Router::getSceneKey(const char* _request, size_t _size) {
+    const char* end = _request + _size;
+
+    // Request line: METHOD SP target SP version
+    const char* target = static_cast<const char*>(memchr(_request, ' ', _size));
+    if (!target) {
+        return "";
+    }
+    target++;
+    const char* target_end = static_cast<const char*>(memchr(target, ' ', end - target));
+    if (!target_end) {
+        return "";
+    }
+
+    const char* query = static_cast<const char*>(memchr(target, '?', target_end - target));
+    if (query) {
+        const char* param = query + 1;
+        while (param < target_end) {
+            const char* param_end = static_cast<const char*>(memchr(param, '&', target_end - param));
+            if (!param_end) {
+                param_end = target_end;
+            }
+            if (param_end - param > 6 && memcmp(param, "scene=", 6) == 0) {
+                return urlDecode(param + 6, param_end);
+            }
+            param = param_end + 1;
+        }
+    }
+
+    // A POSTed scene, hashed in place the same way the worker keys it
+    static const char separator[] = "\r\n\r\n";
+    const char* body = std::search(target_end, end, separator, separator + 4);
+    if (body == end || body + 4 == end) {
+        return "";
+    }
+    body += 4;
+    return sha256Hex(body, end - body);
+}
+
+Router::Worker& Router::getWorker(const char* _beat, size_t _size, size_t _id_size) {
+    uint64_t key = hash64(_beat, _id_size);
+    auto it = m_workers.find(key);
+    if (it == m_workers.end()) {
+        it = m_workers.emplace(key, Worker()).first;
+        addWorker(key, std::string(_beat, _id_size));
+    }
+    Worker &worker = it->second;
+
+    // Same heartbeat as last time, same scenes
+    uint64_t beat_hash = hash64(_beat, _size);
+    if (worker.beat_size == _size && worker.beat_hash == beat_hash) {
+        return worker;
+    }
+    worker.beat_size = _size;
+    worker.beat_hash = beat_hash;
+
+    worker.scenes.clear();
+    const char* end = _beat + _size;
+    for (const char* line = _beat + _id_size; line < end; line++) {
+        const char* eol = static_cast<const char*>(memchr(line, '\n', end - line));
+        if (!eol) {
+            eol = end;
+        }
+        if (eol > line) {
+            worker.scenes.push_back(hash64(line, eol - line));
+        }
+        line = eol;
+    }
+    return worker;
+}
+
+void Router::addWorker(uint64_t _key, const std::string &_id) {
+    for (int i = 0; i < m_replicas; i++) {
+        m_ring[hash64(_id + "#" + std::to_string(i))] = _key;
+    }
+}
+
+void Router::removeWorker(uint64_t _key) {
+    for (auto it = m_ring.begin(); it != m_ring.end();) {
+        if (it->second == _key) {
+            it = m_ring.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    auto worker = m_workers.find(_key);
+    if (worker != m_workers.end()) {
+        m_total_load -= worker->second.load;
+        m_workers.erase(worker);
+    }
+}
+
+void Router::expireWorkers(std::chrono::steady_clock::time_point _now) {
+    const auto expiration = std::chrono::seconds(WORKER_EXPIRATION);
+    if (_now - m_last_expire < expiration) {
+        return;
+    }
+    m_last_expire = _now;
+
+    std::vector<uint64_t> expired;
+    for (const auto& worker : m_workers) {
+        if (_now - worker.second.seen > expiration) {
+            expired.push_back(worker.first);
+        }
+    }
+    for (uint64_t key : expired) {
+        removeWorker(key);
+    }
+}
+
+const zmq::message_t* Router::choose(const std::list<zmq::message_t>& _heart_beats, const std::list<zmq::message_t>& _job) {
+    return choose(_heart_beats, _job, std::chrono::steady_clock::now());
+}
+
+const zmq::message_t* Router::choose(const std::list<zmq::message_t>& _heart_beats, const std::list<zmq::message_t>& _job,
+                                     std::chrono::steady_clock::time_point _now) {
+    m_job++;
+
+    // Workers waiting for a job, and what they have loaded
+    m_available.clear();
+    const zmq::message_t* fresh = nullptr;
+    for (const auto& heart_beat : _heart_beats) {
+        const char* beat = static_cast<const char*>(heart_beat.data());
+        size_t size = heart_beat.size();
+        while (size > 0 && beat[size - 1] == '\0') {
+            size--;
+        }
+        const char* eol = static_cast<const char*>(memchr(beat, '\n', size));
+        size_t id_size = eol ? eol - beat : size;
+        if (id_size == 0) {
+            // Nothing loaded and no job yet
+            if (!fresh) {
+                fresh = &heart_beat;
+            }
+            continue;
+        }
+
+        Worker &worker = getWorker(beat, size, id_size);
+        worker.seen = _now;
+        if (worker.waiting != m_job) {
+            worker.waiting = m_job;
+            worker.heart_beat = &heart_beat;
+            m_available.push_back(&worker);
+        }
+    }
+    expireWorkers(_now);
+
+    if (_job.empty()) {
+        return nullptr;
+    }
+
+    std::string scene_key = getSceneKey(static_cast<const char*>(_job.front().data()), _job.front().size());
+    if (scene_key.empty()) {
+        return nullptr;
+    }
+    uint64_t scene = hash64(scene_key);
+
+    if (m_available.empty()) {
+        return fresh;
+    }
+
+    // Bounded load: nobody takes more than (1 + balance) times the average
+    double capacity = std::ceil((1.0 + m_balance) * (m_total_load + 1.0) / m_workers.size());
+
+    // Is anyone already holding the scene?
+    bool loaded = false;
+    for (const Worker* worker : m_available) {
+        if (worker->load + 1.0 <= capacity && hasScene(worker->scenes, scene)) {
+            loaded = true;
+            break;
+        }
+    }
+
+    // Nobody has it, an idle worker loads it as cheaply as its home would
+    if (!loaded && fresh) {
+        return fresh;
+    }
+
+    // Walk the ring from the home of the scene
+    Worker* chosen = nullptr;
+    auto point = m_ring.lower_bound(scene);
+    for (size_t i = 0; i < m_ring.size() && !chosen; i++, point++) {
+        if (point == m_ring.end()) {
+            point = m_ring.begin();
+        }
+        Worker &worker = m_workers[point->second];
+        if (worker.waiting == m_job && worker.load + 1.0 <= capacity && (!loaded || hasScene(worker.scenes, scene))) {
+            chosen = &worker;
+        }
+    }
+
+    // Everybody waiting is over the bound, take an idle worker or the least loaded of them
+    if (!chosen && fresh) {
+        return fresh;
+    }
+    if (!chosen) {
+        for (Worker* worker : m_available) {
+            if (!chosen || worker->load < chosen->load) {
+                chosen = worker;
+            }
+        }
+    }
+
+    // Account the job
+    for (auto& worker : m_workers) {
+        worker.second.load *= LOAD_DECAY;
+    }
+    m_total_load *= LOAD_DECAY;
+    chosen->load += 1.0;
+    m_total_load += 1.0;
+
+    return chosen->heart_beat;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <prime_server/prime_server.hpp>
+
+// Chooses the worker for every job of paparazzi_proxy:
+//  - scenes are consistent-hashed onto a ring of workers, so every scene has a home worker
+//  - a worker that already has the scene loaded goes before the home worker
+//  - no worker takes more than (1 + balance) times its share of the recent jobs (bounded load)
+//
+// Workers heartbeats are their id followed by the scenes they have loaded, one per line.
+// A worker that hasn't answered any job yet has an empty heartbeat: it counts as idle and
+// takes the jobs whose scene nobody has loaded, until it reports its id.
+// Workers are known by the hash of their id, and a heartbeat is only parsed again when it
+// changes, so the usual job costs a few hashes of the heartbeats and no allocation.
+class Router {
+public:
+    Router(int _replicas = 64, double _balance = 0.25);
+
+    // Returns the heartbeat of the chosen worker, or nullptr to take any of them (when there's no scene)
+    const zmq::message_t*   choose(const std::list<zmq::message_t>& _heart_beats, const std::list<zmq::message_t>& _job);
+    const zmq::message_t*   choose(const std::list<zmq::message_t>& _heart_beats, const std::list<zmq::message_t>& _job,
+                                   std::chrono::steady_clock::time_point _now);
+
+    // Scene url of the job, or the SHA-256 of the POSTed scene, without copying the request
+    static std::string      getSceneKey(const char* _request, size_t _size);
+
+protected:
+    struct Worker {
+        std::vector<uint64_t>                   scenes;             // hash64 of the loaded scenes
+        size_t                                  beat_size = 0;      // last heartbeat parsed
+        uint64_t                                beat_hash = 0;
+        const zmq::message_t*                   heart_beat = nullptr;
+        uint64_t                                waiting = 0;        // job for which heart_beat is current
+        double                                  load = 0.0;
+        std::chrono::steady_clock::time_point   seen;
+    };
+
+    Worker& getWorker(const char* _beat, size_t _size, size_t _id_size);
+    void    addWorker(uint64_t _key, const std::string &_id);
+    void    removeWorker(uint64_t _key);
+    void    expireWorkers(std::chrono::steady_clock::time_point _now);
+
+    std::map<uint64_t, uint64_t>            m_ring;     // hash point -> worker key
+    std::unordered_map<uint64_t, Worker>    m_workers;  // worker key (hash64 of the id) -> worker
+    std::vector<Worker*>                    m_available;
+    std::chrono::steady_clock::time_point   m_last_expire;
+    uint64_t                                m_job;
+
+    int     m_replicas;
+    double  m_balance;
+    double  m_total_load;
+};
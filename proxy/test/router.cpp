@@ -0,0 +1,200 @@
+#include "test.h"
+#include "router.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+// Reaches into the router for what a job can't tell
+struct TestRouter : public Router {
+    TestRouter(int _replicas = 64, double _balance = 0.25) : Router(_replicas, _balance) {}
+    size_t getWorkerCount() const { return m_workers.size(); }
+};
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+static void add(std::list<zmq::message_t> &_list, const std::string &_data) {
+    _list.emplace_back(_data.data(), _data.size());
+}
+
+// Heartbeat of a worker: its id and the scenes it has loaded
+static std::string beat(const std::string &_id, const std::vector<std::string> &_scenes = {}) {
+    std::string beat = _id;
+    for (const auto& scene : _scenes) {
+        beat += "\n" + scene;
+    }
+    return beat;
+}
+
+static std::list<zmq::message_t> job(const std::string &_scene) {
+    std::list<zmq::message_t> job;
+    add(job, "GET /?scene=" + _scene + "&z=2 HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    return job;
+}
+
+// The id of the heartbeat the router picked
+static std::string idOf(const zmq::message_t* _beat) {
+    if (!_beat) {
+        return "";
+    }
+    std::string beat(static_cast<const char*>(_beat->data()), _beat->size());
+    return beat.substr(0, beat.find('\n'));
+}
+
+// Where a scene lands on the ring, worked out independently
+static std::string home(const std::vector<std::string> &_ids, const std::string &_scene, int _replicas = 64) {
+    std::map<uint64_t, std::string> ring;
+    for (const auto& id : _ids) {
+        for (int i = 0; i < _replicas; i++) {
+            ring[hash64(id + "#" + std::to_string(i))] = id;
+        }
+    }
+    auto point = ring.lower_bound(hash64(_scene));
+    return point == ring.end() ? ring.begin()->second : point->second;
+}
+
+static void testSceneKey() {
+    std::string get = "GET /?z=3&scene=http%3A%2F%2Fhost%2Fa%20b.yaml&x=1 HTTP/1.1\r\nHost: h\r\n\r\n";
+    CHECK(Router::getSceneKey(get.data(), get.size()) == "http://host/a b.yaml");
+
+    std::string none = "GET /?z=3&x=1 HTTP/1.1\r\nHost: h\r\n\r\n";
+    CHECK(Router::getSceneKey(none.data(), none.size()) == "");
+
+    // POSTed scenes are known by their content, whatever the headers
+    std::string post = "POST /?z=3 HTTP/1.1\r\nHost: h\r\n\r\nabc";
+    std::string other = "POST /?z=4&x=2 HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc";
+    CHECK(Router::getSceneKey(post.data(), post.size()) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    CHECK(Router::getSceneKey(other.data(), other.size()) == Router::getSceneKey(post.data(), post.size()));
+
+    std::string empty = "POST /?z=3 HTTP/1.1\r\nHost: h\r\n\r\n";
+    CHECK(Router::getSceneKey(empty.data(), empty.size()) == "");
+
+    std::string garbage = "GET";
+    CHECK(Router::getSceneKey(garbage.data(), garbage.size()) == "");
+}
+
+static void testRing() {
+    std::vector<std::string> ids = { "a:1:0", "b:1:0", "c:1:0", "d:1:0" };
+    std::list<zmq::message_t> beats;
+    for (const auto& id : ids) {
+        add(beats, beat(id));
+    }
+
+    // Every scene goes to its home while nobody is loaded
+    for (int i = 0; i < 20; i++) {
+        TestRouter router;
+        std::string scene = "scene" + std::to_string(i) + ".yaml";
+        CHECK(idOf(router.choose(beats, job(scene))) == home(ids, scene));
+    }
+
+    // No scene, anyone
+    TestRouter router;
+    std::list<zmq::message_t> no_scene;
+    add(no_scene, "GET /?z=1 HTTP/1.1\r\n\r\n");
+    CHECK(router.choose(beats, no_scene) == nullptr);
+}
+
+static void testLoaded() {
+    std::vector<std::string> ids = { "a:1:0", "b:1:0", "c:1:0" };
+    std::string scene = "loaded.yaml";
+    std::string home_id = home(ids, scene);
+    std::string holder = home_id == ids[0] ? ids[1] : ids[0];
+
+    // The worker with the scene goes before the home of the scene (loose bound, not tested here)
+    TestRouter router(64, 4.0);
+    std::list<zmq::message_t> beats;
+    for (const auto& id : ids) {
+        add(beats, id == holder ? beat(id, { "other.yaml", scene }) : beat(id));
+    }
+    CHECK(idOf(router.choose(beats, job(scene))) == holder);
+
+    // The same heartbeats again, and then the holder drops the scene
+    CHECK(idOf(router.choose(beats, job(scene))) == holder);
+    beats.clear();
+    for (const auto& id : ids) {
+        add(beats, id == holder ? beat(id, { "other.yaml" }) : beat(id));
+    }
+    CHECK(idOf(router.choose(beats, job(scene))) == home_id);
+}
+
+static void testCapacity() {
+    // One scene, every job: the home takes its bounded share and the rest spill over
+    std::vector<std::string> ids = { "a:1:0", "b:1:0", "c:1:0", "d:1:0" };
+    const int jobs = 200;
+    const double balance = 0.25;
+    TestRouter router(64, balance);
+    std::map<std::string, int> counts;
+    for (int i = 0; i < jobs; i++) {
+        std::list<zmq::message_t> beats;
+        for (const auto& id : ids) {
+            add(beats, beat(id, { "hot.yaml" }));
+        }
+        counts[idOf(router.choose(beats, job("hot.yaml")))]++;
+    }
+
+    int most = 0;
+    for (const auto& count : counts) {
+        most = std::max(most, count.second);
+    }
+    CHECK(counts.size() == ids.size());
+    CHECK(most <= (1.0 + balance) * jobs / ids.size() + 1);
+    CHECK(counts[home(ids, "hot.yaml")] == most);
+}
+
+static void testFresh() {
+    std::vector<std::string> ids = { "a:1:0", "b:1:0" };
+    TestRouter router;
+
+    // Nobody has the scene: the worker without an id loads it
+    std::list<zmq::message_t> beats;
+    add(beats, beat(ids[0], { "one.yaml" }));
+    add(beats, "");
+    add(beats, beat(ids[1]));
+    CHECK(router.choose(beats, job("two.yaml")) == &*std::next(beats.begin()));
+
+    // Somebody has it: that one, not the fresh worker
+    CHECK(idOf(router.choose(beats, job("one.yaml"))) == ids[0]);
+
+    // Only fresh workers waiting
+    std::list<zmq::message_t> only_fresh;
+    add(only_fresh, "");
+    CHECK(router.choose(only_fresh, job("one.yaml")) == &only_fresh.front());
+    CHECK(router.getWorkerCount() == ids.size());
+}
+
+static void testExpiration() {
+    TestRouter router;
+    TimePoint start = std::chrono::steady_clock::now();
+
+    std::list<zmq::message_t> both;
+    add(both, beat("a:1:0"));
+    add(both, beat("b:1:0"));
+    router.choose(both, job("x.yaml"), start);
+    CHECK(router.getWorkerCount() == 2);
+
+    // Only b keeps coming back
+    std::list<zmq::message_t> b;
+    add(b, beat("b:1:0"));
+    router.choose(b, job("x.yaml"), start + std::chrono::seconds(100));
+    CHECK(router.getWorkerCount() == 2);
+    router.choose(b, job("x.yaml"), start + std::chrono::seconds(301));
+    CHECK(router.getWorkerCount() == 1);
+
+    // And every job goes to b, its ring points are all that's left
+    for (int i = 0; i < 10; i++) {
+        CHECK(idOf(router.choose(b, job("s" + std::to_string(i) + ".yaml"), start + std::chrono::seconds(302))) == "b:1:0");
+    }
+}
+
+int main() {
+    testSceneKey();
+    testRing();
+    testLoaded();
+    testCapacity();
+    testFresh();
+    testExpiration();
+    return TEST_RESULT();
+}
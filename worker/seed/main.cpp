@@ -0,0 +1,329 @@
+// paparazzi_seed: renders every tile of a bounding box and a zoom range straight
+// to a folder ({z}/{x}/{y}.png) or an MBTiles file, with no http server in between.
+//
+//   paparazzi_seed --scene=URL --bbox=minlon,minlat,maxlon,maxlat --zoom=MIN[-MAX] --output=PATH [--option=value ...]
+
+//nuts and bolts required
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <curl/curl.h>
+
+// Paparazzi
+#include "context.h"
+#include "paparazzi.h"
+#include "platform_paparazzi.h"
+#include "config.h"
+#include "tools/image_encoder.h"
+#include "tools/mbtiles.h"
+#include "tools/thread_pool.h"
+
+struct SeedOptions {
+    std::string scene;
+    double      bbox[4] = {0., 0., 0., 0.};    // minlon, minlat, maxlon, maxlat
+    int         min_zoom = -1;
+    int         max_zoom = -1;
+    std::string output;
+    float       density = 1.0f;
+    bool        transparent = false;
+    ImageOptions options;
+};
+
+// A block of _size x _size tiles rendered at once, in Hilbert order inside its zoom level
+struct SeedJob {
+    uint32_t    x, y, z, size;
+    uint64_t    order;
+};
+
+static void usage(const char* _name) {
+    std::cerr << "Usage: " << _name << " --scene=URL --bbox=minlon,minlat,maxlon,maxlat --zoom=MIN[-MAX] --output=DIR|FILE.mbtiles" << std::endl
+              << "       [--format=png|png8|jpg|webp] [--density=N] [--transparent=true] [--quality=N] [--compression=N]" << std::endl
+              << "       [--slots=N] [--metatile=N, a power of two] [--tile-cache-dir=PATH] ..." << std::endl;
+}
+
+// Position of (_x, _y) along the Hilbert curve that fills a _side x _side grid (_side is a power of two)
+static uint64_t hilbert(uint64_t _side, uint64_t _x, uint64_t _y) {
+    uint64_t d = 0;
+    for (uint64_t s = _side / 2; s > 0; s /= 2) {
+        uint64_t rx = (_x & s) > 0;
+        uint64_t ry = (_y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                _x = s - 1 - _x;
+                _y = s - 1 - _y;
+            }
+            std::swap(_x, _y);
+        }
+    }
+    return d;
+}
+
+static uint32_t lonToTileX(double _lon, uint32_t _z) {
+    double n = pow(2.0, _z);
+    return (uint32_t)std::max(0.0, std::min(n - 1., floor((_lon + 180.0) / 360.0 * n)));
+}
+
+static uint32_t latToTileY(double _lat, uint32_t _z) {
+    double n = pow(2.0, _z);
+    double lat = std::max(-85.0511, std::min(85.0511, _lat)) * M_PI / 180.0;
+    return (uint32_t)std::max(0.0, std::min(n - 1., floor((1.0 - log(tan(lat) + 1.0 / cos(lat)) / M_PI) / 2.0 * n)));
+}
+
+static bool makeDirs(const std::string &_path) {
+    for (size_t i = 1; i <= _path.size(); i++) {
+        if (i == _path.size() || _path[i] == '/') {
+            if (mkdir(_path.substr(0, i).c_str(), 0755) != 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool writeFile(const std::string &_path, const std::string &_data) {
+    FILE *file = fopen(_path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool done = fwrite(_data.data(), 1, _data.size(), file) == _data.size();
+    return fclose(file) == 0 && done;
+}
+
+static bool parseOptions(int _argc, char* _argv[], SeedOptions &_seed, Config &_config) {
+    // Whatever is not about seeding goes to the worker settings
+    std::vector<char*> rest;
+    for (int i = 1; i < _argc; i++) {
+        std::string arg(_argv[i]);
+        size_t eq = arg.find('=');
+        std::string name = eq == std::string::npos ? arg : arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        try {
+            if (name == "--scene") {
+                _seed.scene = value;
+            } else if (name == "--bbox") {
+                std::istringstream in(value);
+                char comma;
+                if (!(in >> _seed.bbox[0] >> comma >> _seed.bbox[1] >> comma >> _seed.bbox[2] >> comma >> _seed.bbox[3]))
+                    throw std::invalid_argument(value);
+            } else if (name == "--zoom") {
+                size_t dash = value.find('-');
+                _seed.min_zoom = std::stoi(value.substr(0, dash));
+                _seed.max_zoom = dash == std::string::npos ? _seed.min_zoom : std::stoi(value.substr(dash + 1));
+            } else if (name == "--output") {
+                _seed.output = value;
+            } else if (name == "--format") {
+                if (!ImageEncoder::getFormat(value, _seed.options.format))
+                    throw std::invalid_argument(value);
+            } else if (name == "--density") {
+                _seed.density = std::max(1.f, std::stof(value));
+            } else if (name == "--transparent") {
+                _seed.transparent = value == "true" || value == "1";
+            } else if (name == "--quality") {
+                _seed.options.quality = std::min(100, std::max(1, std::stoi(value)));
+            } else if (name == "--compression") {
+                _seed.options.compression = std::min(9, std::max(0, std::stoi(value)));
+            } else {
+                rest.push_back(_argv[i]);
+            }
+        }
+        catch(const std::exception& e) {
+            std::cerr << "Bad value for " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (_seed.scene.empty() || _seed.output.empty() || _seed.min_zoom < 0 || _seed.max_zoom < _seed.min_zoom || _seed.max_zoom > 30 ||
+        _seed.bbox[0] >= _seed.bbox[2] || _seed.bbox[1] >= _seed.bbox[3]) {
+        return false;
+    }
+
+    if (!_config.parse(rest.size(), rest.data(), 0)) {
+        return false;
+    }
+
+    // Metatiles line up with the tiles of every zoom, none is rendered twice
+    if (_config.metatile < 1 || (_config.metatile & (_config.metatile - 1)) != 0) {
+        std::cerr << "--metatile has to be a power of two" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    SeedOptions seed;
+    Config config;
+    config.metatile = 4;
+    if (!parseOptions(argc, argv, seed, config)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::string extension = seed.options.format == IMAGE_FORMAT_JPEG ? "jpg" :
+                            seed.options.format == IMAGE_FORMAT_WEBP ? "webp" : "png";
+
+    //where the tiles go
+    std::unique_ptr<MBTilesWriter> archive;
+    bool to_archive = seed.output.size() > 8 && seed.output.compare(seed.output.size() - 8, 8, ".mbtiles") == 0;
+    if (to_archive) {
+        std::ostringstream bounds;
+        bounds << seed.bbox[0] << "," << seed.bbox[1] << "," << seed.bbox[2] << "," << seed.bbox[3];
+        archive = std::unique_ptr<MBTilesWriter>(new MBTilesWriter(seed.output, {
+            {"name", seed.scene}, {"type", "baselayer"}, {"version", "1"}, {"format", extension},
+            {"bounds", bounds.str()}, {"minzoom", std::to_string(seed.min_zoom)}, {"maxzoom", std::to_string(seed.max_zoom)}}));
+        if (!archive->isOpen())
+            return EXIT_FAILURE;
+    }
+
+    //every metatile touching the bbox, walked in Hilbert order so neighbours share the fetched tiles
+    std::vector<SeedJob> jobs;
+    size_t total = 0;
+    for (uint32_t z = seed.min_zoom; z <= (uint32_t)seed.max_zoom; z++) {
+        uint32_t tiles = 1u << z;
+        uint32_t size = std::min<uint32_t>(config.metatile, tiles);
+        while (size > 1 && TILE_SIZE * size * seed.density > MAX_METATILE_SIZE)
+            size /= 2;
+
+        uint32_t min_x = lonToTileX(seed.bbox[0], z), max_x = lonToTileX(seed.bbox[2], z);
+        uint32_t min_y = latToTileY(seed.bbox[3], z), max_y = latToTileY(seed.bbox[1], z);
+        total += (max_x - min_x + 1) * (max_y - min_y + 1);
+
+        uint64_t side = 1;
+        while (side * size < tiles)
+            side *= 2;
+
+        std::vector<SeedJob> level;
+        for (uint32_t my = min_y / size; my <= max_y / size; my++) {
+            for (uint32_t mx = min_x / size; mx <= max_x / size; mx++) {
+                level.push_back(SeedJob{mx * size, my * size, z, size, hilbert(side, mx, my)});
+            }
+        }
+        std::sort(level.begin(), level.end(), [](const SeedJob &_a, const SeedJob &_b) { return _a.order < _b.order; });
+        jobs.insert(jobs.end(), level.begin(), level.end());
+    }
+    std::cerr << "Seeding " << total << " tiles in " << jobs.size() << " metatiles" << std::endl;
+
+    //url requests, fetched tiles and fonts are shared by all the render slots
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    UrlClient::Options urlClientOptions;
+    urlClientOptions.numberOfThreads = 10;
+    auto platform = std::make_shared<PaparazziPlatform>(urlClientOptions);
+    if (!config.tile_cache_dir.empty())
+        platform->setTileCache(std::make_shared<DiskCache>(config.tile_cache_dir, config.tile_cache_dir_size));
+
+#ifdef PLATFORM_RPI
+    config.slots = 1;
+#endif
+    for (int i = 0; i < config.slots; i++)
+        initGL(100, 100, i);
+    releaseGL();
+
+    //metatiles are sliced, encoded and written on threads shared by all the slots
+    auto pool = std::make_shared<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+    std::atomic<size_t> next_job(0);
+    std::atomic<size_t> done(0);
+    std::atomic<size_t> failed(0);
+    std::list<std::thread> slot_threads;
+    for (int i = 0; i < config.slots; i++) {
+        slot_threads.emplace_back([&, i]() {
+            makeCurrentGL(i);
+            Paparazzi paparazzi{platform, config, nullptr, pool, seed.scene};
+
+            std::vector<unsigned char> pixels;
+            for (size_t j = next_job++; j < jobs.size(); j = next_job++) {
+                const SeedJob &job = jobs[j];
+                ViewState view;
+                view.density = seed.density;
+                Paparazzi::getMetatileView(job.x, job.y, job.z, job.size, view);
+
+                //only the tiles that fall inside the bbox are kept (and counted)
+                uint32_t min_x = lonToTileX(seed.bbox[0], job.z), max_x = lonToTileX(seed.bbox[2], job.z);
+                uint32_t min_y = latToTileY(seed.bbox[3], job.z), max_y = latToTileY(seed.bbox[1], job.z);
+
+                unsigned int width = 0, height = 0;
+                bool taken;
+                if (paparazzi.isTiled(view)) {
+                    //over what the GL limits allow at the antialiasing scale, put together from smaller pictures
+                    pixels.clear();
+                    taken = paparazzi.takeTiledPicture(view, seed.transparent, [&](const unsigned char *_rows, unsigned int _width, unsigned int _count) {
+                        pixels.insert(pixels.end(), _rows, _rows + _width * _count * 4);
+                        width = _width;
+                        height += _count;
+                    });
+                } else {
+                    taken = paparazzi.takePicture(view, seed.transparent, [&](const unsigned char *_pixels, unsigned int _width, unsigned int _height) {
+                        pixels.assign(_pixels, _pixels + _width * _height * 4);
+                        width = _width;
+                        height = _height;
+                    });
+                }
+                if (!taken) {
+                    size_t columns = std::min(max_x, job.x + job.size - 1) - std::max(min_x, job.x) + 1;
+                    size_t rows = std::min(max_y, job.y + job.size - 1) - std::max(min_y, job.y) + 1;
+                    failed += columns * rows;
+                    done += columns * rows;
+                    continue;
+                }
+
+                uint32_t tile_width = width / job.size, tile_height = height / job.size;
+                size_t stride = width * 4, tile_stride = tile_width * 4;
+                pool->parallelFor(job.size * job.size, [&](uint32_t _i) {
+                    uint32_t row = _i / job.size, column = _i % job.size;
+                    uint32_t x = job.x + column, y = job.y + row;
+                    if (x < min_x || x > max_x || y < min_y || y > max_y)
+                        return;
+
+                    bool written = false;
+                    try {
+                        std::vector<unsigned char> tile(tile_stride * tile_height);
+                        const unsigned char *origin = pixels.data() + row * tile_height * stride + column * tile_stride;
+                        for (uint32_t k = 0; k < tile_height; k++)
+                            memcpy(&tile[k * tile_stride], origin + k * stride, tile_stride);
+
+                        std::string image;
+                        std::unique_ptr<ImageEncoder> encoder = ImageEncoder::create(seed.options.format);
+                        written = encoder->encode(image, tile.data(), tile_width, tile_height, 4, seed.options);
+                        if (written && archive) {
+                            written = archive->putTile(job.z, x, y, image);
+                        } else if (written) {
+                            std::string dir = seed.output + "/" + std::to_string(job.z) + "/" + std::to_string(x);
+                            written = makeDirs(dir) && writeFile(dir + "/" + std::to_string(y) + "." + extension, image);
+                        }
+                    }
+                    catch(const std::exception&) {
+                        written = false;
+                    }
+
+                    if (!written)
+                        failed++;
+                    if (++done % 1000 == 0)
+                        std::cerr << done << " / " << total << " tiles" << std::endl;
+                });
+            }
+        });
+    }
+
+    for (auto& slot_thread : slot_threads)
+        slot_thread.join();
+    archive.reset();
+
+    closeGL();
+    curl_global_cleanup();
+
+    std::cerr << done << " tiles done, " << failed << " failed" << std::endl;
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
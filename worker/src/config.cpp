@@ -0,0 +1,62 @@
+#include "config.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#define MEGABYTE (1024 * 1024)
+
+bool Config::parse(int _argc, char* _argv[], int _first) {
+    for (int i = _first; i < _argc; i++) {
+        std::string arg(_argv[i]);
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+            std::cerr << "Bad option " << arg << std::endl;
+            return false;
+        }
+
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        try {
+            if (name == "slots") {
+                slots = std::max(1, std::stoi(value));
+            } else if (name == "scenes") {
+                scenes = std::max(1, std::stoi(value));
+            } else if (name == "metatile") {
+                metatile = std::max(1, std::min(16, std::stoi(value)));
+            } else if (name == "encoders") {
+                encoders = std::max(1, std::stoi(value));
+            } else if (name == "aa") {
+                uint32_t mode;
+                if (!AntiAliasedBuffer::getMode(value.data(), value.size(), mode))
+                    throw std::invalid_argument(value);
+                aa = mode;
+            } else if (name == "aa-scale") {
+                aa_scale = std::max(1.0f, std::min((float)AA_MAX_SCALE, std::stof(value)));
+            } else if (name == "aa-kernel") {
+                uint32_t kernel;
+                if (!AntiAliasedBuffer::getKernel(value.data(), value.size(), kernel))
+                    throw std::invalid_argument(value);
+                aa_kernel = kernel;
+            } else if (name == "image-cache") {
+                image_cache_size = std::stoul(value) * MEGABYTE;
+            } else if (name == "image-cache-dir") {
+                image_cache_dir = value;
+            } else if (name == "image-cache-dir-size") {
+                image_cache_dir_size = std::stoul(value) * MEGABYTE;
+            } else if (name == "tile-cache-dir") {
+                tile_cache_dir = value;
+            } else if (name == "tile-cache-dir-size") {
+                tile_cache_dir_size = std::stoul(value) * MEGABYTE;
+            } else {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+        catch(const std::exception& e) {
+            std::cerr << "Bad value for " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
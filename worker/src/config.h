@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "tools/aab.h"
+
+// Worker settings, from the command line options that follow the endpoints:
+//   paparazzi_worker upstream loopback [--option=value ...]
+struct Config {
+    int         slots               = 1;                    // --slots=N, maps rendering at the same time
+    int         scenes              = 1;                    // --scenes=N, loaded scenes kept by each slot
+    int         metatile            = 1;                    // --metatile=N, tiles per side rendered at once (needs the image cache)
+    int         encoders            = 2;                    // --encoders=N, encoder threads
+    int         aa                  = AA_SUPERSAMPLE;       // --aa=none|ssaa|msaa, antialiasing when the request doesn't say
+    float       aa_scale            = 2.0f;                 // --aa-scale=S, supersampling scale, fractional ones too (1-4)
+    int         aa_kernel           = AA_KERNEL_BOX;        // --aa-kernel=box|bilinear|lanczos2, supersampling downsample kernel
+    size_t      image_cache_size    = 0;                    // --image-cache=MB, off unless asked for
+    std::string image_cache_dir     = "";                   // --image-cache-dir=PATH, shared by the host workers
+    size_t      image_cache_dir_size = 1024 * 1024 * 1024;  // --image-cache-dir-size=MB
+    std::string tile_cache_dir      = "";                   // --tile-cache-dir=PATH, fetched tiles shared by the host workers
+    size_t      tile_cache_dir_size = 4096UL * 1024 * 1024; // --tile-cache-dir-size=MB
+
+    // Returns false on unknown or malformed options
+    bool        parse(int _argc, char* _argv[], int _first);
+};
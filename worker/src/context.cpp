@@ -1,5 +1,7 @@
 #include "context.h"
 
+#include <vector>
+
 static bool bRender;
 
 #ifdef PLATFORM_RPI
@@ -20,16 +22,103 @@ EGLSurface surface;
 EGLContext context;
 struct timeval tv;
 unsigned long long timeStart;
+#elif defined(HEADLESS_EGL)
+//  ---------------------------------------- using EGL, no window system
+//
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+struct Slot {
+    EGLContext context = EGL_NO_CONTEXT;
+    EGLSurface surface = EGL_NO_SURFACE;    // tiny pbuffer, or none when surfaceless
+};
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLConfig config;
+static bool pbuffer = false;
+static std::vector<Slot> slots;
+static std::chrono::steady_clock::time_point timeStart;
+#elif defined(HEADLESS_OSMESA)
+//  ---------------------------------------- using OSMesa, software only
+//
+#include <GL/osmesa.h>
+#include <chrono>
+#include <cstdio>
+
+struct Slot {
+    OSMesaContext               context = NULL;
+    std::vector<unsigned char>  buffer; // never read, paparazzi renders into its own FBOs
+    int                         width = 0;
+    int                         height = 0;
+};
+static std::vector<Slot> slots;
+static std::chrono::steady_clock::time_point timeStart;
 #else
 //  ---------------------------------------- using GLFW
 //
-static GLFWwindow* window;
+static std::vector<GLFWwindow*> windows;
+#endif
+
+#ifdef HEADLESS_EGL
+static bool hasExtension(const char* _extensions, const char* _name) {
+    size_t size = strlen(_name);
+    for (const char* found = _extensions ? strstr(_extensions, _name) : NULL; found; found = strstr(found + size, _name)) {
+        bool starts = found == _extensions || found[-1] == ' ';
+        bool ends = found[size] == ' ' || found[size] == '\0';
+        if (starts && ends) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static EGLDisplay initDisplay(EGLDisplay _display) {
+    if (_display != EGL_NO_DISPLAY && eglInitialize(_display, NULL, NULL)) {
+        return _display;
+    }
+    return EGL_NO_DISPLAY;
+}
+
+// A GPU straight from its device, then Mesa surfaceless (llvmpipe on CPU only hosts),
+// then whatever the default display is. None of them needs an X server.
+static EGLDisplay getHeadlessDisplay() {
+    const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay headless = EGL_NO_DISPLAY;
+
+    if (getPlatformDisplay && hasExtension(extensions, "EGL_EXT_platform_device")) {
+        auto queryDevices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+        EGLDeviceEXT devices[8];
+        EGLint count = 0;
+        if (queryDevices && queryDevices(8, devices, &count) && count > 0) {
+            headless = initDisplay(getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[0], NULL));
+        }
+    }
+
+    if (headless == EGL_NO_DISPLAY && getPlatformDisplay && hasExtension(extensions, "EGL_MESA_platform_surfaceless")) {
+        headless = initDisplay(getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL));
+    }
+
+    if (headless == EGL_NO_DISPLAY) {
+        headless = initDisplay(eglGetDisplay(EGL_DEFAULT_DISPLAY));
+    }
+    return headless;
+}
 #endif
 
 // Initialize the OpenGL library
-void initGL(int width, int height) {
+void initGL(int width, int height, int slot) {
 
     #ifdef PLATFORM_RPI
+    // Only one context on the RPi
+    assert(slot == 0);
+
     // Start clock
     gettimeofday(&tv, NULL);
     timeStart = (unsigned long long)(tv.tv_sec) * 1000 +
@@ -138,32 +227,150 @@ void initGL(int width, int height) {
     glViewport(0.0f, 0.0f, (float)screen_width, (float)screen_height);
     check();
 
+    #elif defined(HEADLESS_EGL)
+    //  ---------------------------------------- using EGL, no window system
+    //
+    if (display == EGL_NO_DISPLAY) {
+        timeStart = std::chrono::steady_clock::now();
+
+        display = getHeadlessDisplay();
+        if (display == EGL_NO_DISPLAY) {
+            fprintf(stderr, "No EGL display\n");
+            return;
+        }
+
+        // Pictures are rendered into FBOs, the surface is only there for drivers that need one
+        EGLint attributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_ALPHA_SIZE, 8,
+            EGL_DEPTH_SIZE, 16,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLint num_config = 0;
+        pbuffer = eglChooseConfig(display, attributes, &config, 1, &num_config) && num_config > 0;
+        if (!pbuffer) {
+            attributes[1] = 0;
+            const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+            if (!hasExtension(extensions, "EGL_KHR_surfaceless_context") ||
+                !eglChooseConfig(display, attributes, &config, 1, &num_config) || num_config == 0) {
+                fprintf(stderr, "No EGL config to render offscreen\n");
+                return;
+            }
+        }
+        eglBindAPI(EGL_OPENGL_API);
+    }
+
+    if ((int)slots.size() <= slot) {
+        slots.resize(slot + 1);
+    }
+    Slot &current = slots[slot];
+    current.context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+    if (current.context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "Couldn't create the EGL context of slot %d\n", slot);
+        return;
+    }
+    if (pbuffer) {
+        const EGLint size[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+        current.surface = eglCreatePbufferSurface(display, config, size);
+    }
+
+    // Make the slot context current
+    eglMakeCurrent(display, current.surface, current.surface, current.context);
+
+    #elif defined(HEADLESS_OSMESA)
+    //  ---------------------------------------- using OSMesa, software only
+    //
+    if (slots.empty()) {
+        timeStart = std::chrono::steady_clock::now();
+    }
+
+    if ((int)slots.size() <= slot) {
+        slots.resize(slot + 1);
+    }
+    Slot &current = slots[slot];
+    current.context = OSMesaCreateContextExt(OSMESA_RGBA, 16, 8, 0, NULL);
+    if (!current.context) {
+        fprintf(stderr, "Couldn't create the OSMesa context of slot %d\n", slot);
+        return;
+    }
+    current.width = width;
+    current.height = height;
+    current.buffer.resize(width * height * 4);
+
+    // Make the slot context current
+    OSMesaMakeCurrent(current.context, current.buffer.data(), GL_UNSIGNED_BYTE, width, height);
+
     #else
     //  ---------------------------------------- using GLFW
     //
-    if (!glfwInit()) {
+    if (windows.empty() && !glfwInit()) {
         return;
     }
 
     glfwWindowHint(GLFW_SAMPLES, 2);
     glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-    window = glfwCreateWindow(width, height, "", NULL, NULL);
-    if (!window) {
+    GLFWwindow* window = glfwCreateWindow(width, height, "", NULL, NULL);
+    if (!window && windows.empty()) {
         glfwTerminate();
     }
 
-    // Make the main_window's context current
+    if ((int)windows.size() <= slot) {
+        windows.resize(slot + 1, NULL);
+    }
+    windows[slot] = window;
+
+    // Make the slot window's context current
     glfwMakeContextCurrent(window);
     #endif
 }
 
+void makeCurrentGL(int slot) {
+    #ifdef PLATFORM_RPI
+    eglMakeCurrent(display, surface, surface, context);
+    #elif defined(HEADLESS_EGL)
+    if (slot < (int)slots.size()) {
+        eglMakeCurrent(display, slots[slot].surface, slots[slot].surface, slots[slot].context);
+    }
+    #elif defined(HEADLESS_OSMESA)
+    if (slot < (int)slots.size() && slots[slot].context) {
+        Slot &current = slots[slot];
+        OSMesaMakeCurrent(current.context, current.buffer.data(), GL_UNSIGNED_BYTE, current.width, current.height);
+    }
+    #else
+    //  ---------------------------------------- using GLFW
+    //
+    glfwMakeContextCurrent(slot < (int)windows.size() ? windows[slot] : NULL);
+    #endif
+}
+
+void releaseGL() {
+    #if defined(PLATFORM_RPI) || defined(HEADLESS_EGL)
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    #elif defined(HEADLESS_OSMESA)
+    OSMesaMakeCurrent(NULL, NULL, GL_UNSIGNED_BYTE, 0, 0);
+    #else
+    //  ---------------------------------------- using GLFW
+    //
+    glfwMakeContextCurrent(NULL);
+    #endif
+}
+
 void renderGL() {
     #ifdef PLATFORM_RPI
     eglSwapBuffers(display, surface);
+    #elif defined(HEADLESS_EGL) || defined(HEADLESS_OSMESA)
+    // Nothing to show
+    glFlush();
     #else
     //  ---------------------------------------- using GLFW
     //
-    glfwSwapBuffers(window);
+    if (!windows.empty() && windows[0]) {
+        glfwSwapBuffers(windows[0]);
+    }
     #endif
 }
 
@@ -189,9 +396,41 @@ void closeGL() {
     }
     bcm_host_deinit();
 
+    #elif defined(HEADLESS_EGL)
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    for (Slot &current : slots) {
+        if (current.surface != EGL_NO_SURFACE) {
+            eglDestroySurface(display, current.surface);
+        }
+        if (current.context != EGL_NO_CONTEXT) {
+            eglDestroyContext(display, current.context);
+        }
+    }
+    slots.clear();
+    if (display != EGL_NO_DISPLAY) {
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+    }
+    eglReleaseThread();
+
+    #elif defined(HEADLESS_OSMESA)
+    OSMesaMakeCurrent(NULL, NULL, GL_UNSIGNED_BYTE, 0, 0);
+    for (Slot &current : slots) {
+        if (current.context) {
+            OSMesaDestroyContext(current.context);
+        }
+    }
+    slots.clear();
+
     #else
     //  ---------------------------------------- using GLFW
     //
+    for (GLFWwindow* window : windows) {
+        if (window) {
+            glfwDestroyWindow(window);
+        }
+    }
+    windows.clear();
     glfwTerminate();
     #endif
 }
@@ -201,6 +440,8 @@ double getTime() {
     gettimeofday(&tv, NULL);
     unsigned long long timeNow = (unsigned long long)(tv.tv_sec) * 1000 + (unsigned long long)(tv.tv_usec) / 1000;
     return (timeNow - timeStart)*0.001;
+    #elif defined(HEADLESS_EGL) || defined(HEADLESS_OSMESA)
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - timeStart).count();
     #else
     //  ---------------------------------------- using GLFW
     //
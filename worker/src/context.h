@@ -4,7 +4,11 @@
 #undef countof
 
 // GL Context
-void    initGL(int width, int height);
+//  Every render slot has its own context. Create them all from the main thread,
+//  then make each one current on the thread that renders with it.
+void    initGL(int width, int height, int slot = 0);
+void    makeCurrentGL(int slot = 0);
+void    releaseGL();
 void    renderGL();
 void    closeGL();
 
@@ -0,0 +1,146 @@
+#include "encoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "headers.h"
+
+Encoder::Encoder(std::shared_ptr<ImageCache> _cache, std::shared_ptr<ThreadPool> _pool) : m_cache(_cache), m_pool(_pool) {
+}
+
+Encoder::~Encoder() {
+}
+
+void Encoder::makeRawImage(std::string &_message, const RawImageHeader &_header, const std::string &_key, const unsigned char *_pixels) {
+    RawImageHeader header = _header;
+    header.key_size = _key.size();
+
+    size_t size = header.width * header.height * header.depth;
+    _message.resize(sizeof(RawImageHeader) + header.key_size + size);
+    memcpy(&_message[0], &header, sizeof(RawImageHeader));
+    memcpy(&_message[sizeof(RawImageHeader)], _key.data(), header.key_size);
+    memcpy(&_message[sizeof(RawImageHeader) + header.key_size], _pixels, size);
+}
+
+void Encoder::parallelFor(uint32_t _count, const std::function<void(uint32_t)> &_function) {
+    if (m_pool) {
+        m_pool->parallelFor(_count, _function);
+    } else {
+        for (uint32_t i = 0; i < _count; i++) {
+            _function(i);
+        }
+    }
+}
+
+// prime_server stuff
+worker_t::result_t Encoder::work (const std::list<zmq::message_t>& job, void* request_info) {
+    //false means this is going back to the client, there is no next stage of the pipeline
+    worker_t::result_t result{false};
+
+    //this type differs per protocol hence the void* fun
+    auto& info = *static_cast<http_request_t::info_t*>(request_info);
+
+    http_response_t response;
+    try {
+        if (job.empty())
+            throw std::runtime_error("nothing to encode");
+
+        std::string image, mime;
+        encodeMessage(job.front(), image, mime);
+        response = http_response_t(200, "OK", image, headers_t{CORS, {"Content-type", mime}});
+    }
+    catch(const std::exception& e) {
+        //complain
+        response = http_response_t(500, "Internal Server Error", e.what(), headers_t{CORS});
+    }
+
+    //does some tricky stuff with headers and different versions of http
+    response.from_info(info);
+
+    //formats the response to protocal that the client will understand
+    result.messages.emplace_back(response.to_string());
+    return result;
+}
+
+void Encoder::encodeMessage(const zmq::message_t &_message, std::string &_image, std::string &_mime) {
+    if (_message.size() < sizeof(RawImageHeader))
+        throw std::runtime_error("raw image without header");
+
+    RawImageHeader header;
+    memcpy(&header, _message.data(), sizeof(RawImageHeader));
+    if (_message.size() != sizeof(RawImageHeader) + header.key_size + header.width * header.height * header.depth)
+        throw std::runtime_error("raw image size doesn't match its header");
+
+    const char *data = static_cast<const char*>(_message.data());
+    std::string key(data + sizeof(RawImageHeader), header.key_size);
+    const unsigned char *pixels = reinterpret_cast<const unsigned char*>(data + sizeof(RawImageHeader) + header.key_size);
+
+    std::unique_ptr<ImageEncoder> encoder = ImageEncoder::create(header.options.format);
+    if (!encoder)
+        throw std::runtime_error("unknown image format");
+
+    uint32_t tiles = header.columns * header.rows;
+    if (tiles == 0 || header.tile >= tiles || header.width % header.columns != 0 || header.height % header.rows != 0)
+        throw std::runtime_error("bad metatile grid");
+
+    if (tiles > 1) {
+        if (!encodeTiles(_image, header, key, pixels))
+            throw std::runtime_error("couldn't encode the metatile");
+    } else {
+        if (!encoder->encode(_image, pixels, header.width, header.height, header.depth, header.options))
+            throw std::runtime_error("couldn't encode the image");
+
+        if (m_cache && !key.empty())
+            m_cache->put(key, CachedImage{encoder->getMime(), _image});
+    }
+
+    _mime = encoder->getMime();
+}
+
+bool Encoder::encodeTiles(std::string &_image, const RawImageHeader &_header, const std::string &_keys, const unsigned char *_pixels) {
+    uint32_t count = _header.columns * _header.rows;
+
+    std::vector<std::string> keys;
+    size_t start = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t end = _keys.find('\0', start);
+        keys.push_back(_keys.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        start = end == std::string::npos ? _keys.size() : end + 1;
+    }
+
+    uint32_t tile_width = _header.width / _header.columns;
+    uint32_t tile_height = _header.height / _header.rows;
+    size_t stride = _header.width * _header.depth;
+    size_t tile_stride = tile_width * _header.depth;
+
+    std::vector<std::string> images(count);
+    parallelFor(count, [&](uint32_t _i) {
+        try {
+            std::vector<unsigned char> tile(tile_stride * tile_height);
+            const unsigned char *origin = _pixels + (_i / _header.columns) * tile_height * stride + (_i % _header.columns) * tile_stride;
+            for (uint32_t y = 0; y < tile_height; y++) {
+                memcpy(&tile[y * tile_stride], origin + y * stride, tile_stride);
+            }
+
+            std::unique_ptr<ImageEncoder> encoder = ImageEncoder::create(_header.options.format);
+            if (encoder->encode(images[_i], tile.data(), tile_width, tile_height, _header.depth, _header.options) &&
+                m_cache && !keys[_i].empty()) {
+                m_cache->put(keys[_i], CachedImage{encoder->getMime(), images[_i]});
+            }
+        }
+        catch(const std::exception&) {
+            // the tile stays empty
+            images[_i].clear();
+        }
+    });
+
+    _image = std::move(images[_header.tile]);
+    return !_image.empty();
+}
+
+void Encoder::cleanup () {
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+//prime_server guts
+#include <prime_server/prime_server.hpp>
+#include <prime_server/http_protocol.hpp>
+using namespace prime_server;
+
+#include "tools/image_encoder.h"
+#include "tools/thread_pool.h"
+#include "image_cache.h"
+
+// Header of the raw images the render stage hands to the encoder stage.
+// The cache key (key_size bytes) and the pixels follow it in the same message.
+// Metatiles are a grid of tiles, with one key per tile ('\0' separated).
+struct RawImageHeader {
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    depth;
+    uint32_t    key_size;
+    uint32_t    columns = 1;
+    uint32_t    rows = 1;
+    uint32_t    tile = 0;       // the tile that answers the request
+    ImageOptions options;
+};
+
+// Second stage of the worker pipeline: turns raw pixels into the final
+// image while the render thread is already working on the next request
+class Encoder {
+public:
+    Encoder(std::shared_ptr<ImageCache> _cache = nullptr, std::shared_ptr<ThreadPool> _pool = nullptr);
+    ~Encoder();
+
+    // Pack a raw image in to a message for the encoder stage
+    static void makeRawImage(std::string &_message, const RawImageHeader &_header, const std::string &_key, const unsigned char *_pixels);
+
+    // prime_server stuff
+    worker_t::result_t work (const std::list<zmq::message_t>& job, void* request_info);
+    void    cleanup();
+
+protected:
+    // Encode (and cache) one raw image message
+    void    encodeMessage(const zmq::message_t &_message, std::string &_image, std::string &_mime);
+
+    // Slice a metatile and encode its tiles in parallel, returns the requested one
+    bool    encodeTiles(std::string &_image, const RawImageHeader &_header, const std::string &_keys, const unsigned char *_pixels);
+
+    // On the shared pool, or one after the other without it
+    void    parallelFor(uint32_t _count, const std::function<void(uint32_t)> &_function);
+
+    std::shared_ptr<ImageCache> m_cache;
+    std::shared_ptr<ThreadPool> m_pool;
+};
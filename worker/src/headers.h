@@ -0,0 +1,11 @@
+#pragma once
+
+//prime_server guts
+#include <prime_server/prime_server.hpp>
+#include <prime_server/http_protocol.hpp>
+using namespace prime_server;
+
+// HTTP RESPONSE HEADERS
+const headers_t::value_type CORS{"Access-Control-Allow-Origin", "*"};
+const headers_t::value_type PNG_MIME{"Content-type", "image/png"};
+const headers_t::value_type TXT_MIME{"Content-type", "text/plain;charset=utf-8"};
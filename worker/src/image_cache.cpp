@@ -0,0 +1,52 @@
+#include "image_cache.h"
+
+ImageCache::ImageCache(size_t _memory_size, const std::string &_disk_path, size_t _disk_size) : m_memory(_memory_size) {
+    if (!_disk_path.empty() && _disk_size > 0) {
+        m_disk = std::unique_ptr<DiskCache>(new DiskCache(_disk_path, _disk_size));
+    }
+}
+
+ImageCache::~ImageCache() {
+}
+
+bool ImageCache::get(const std::string &_key, CachedImage &_image) {
+    std::shared_ptr<const CachedImage> image;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_memory.get(_key, image);
+    }
+
+    if (image) {
+        _image = *image;
+        return true;
+    }
+
+    // Maybe an other worker did it: the mime type goes first, in its own line
+    std::string data;
+    if (m_disk && m_disk->get(_key, data)) {
+        size_t eol = data.find('\n');
+        if (eol != std::string::npos) {
+            auto cached = std::make_shared<CachedImage>();
+            cached->mime = data.substr(0, eol);
+            cached->data = data.substr(eol + 1);
+            _image = *cached;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_memory.put(_key, cached, cached->data.size());
+            return true;
+        }
+    }
+    return false;
+}
+
+void ImageCache::put(const std::string &_key, const CachedImage &_image) {
+    auto cached = std::make_shared<const CachedImage>(_image);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_memory.put(_key, cached, cached->data.size());
+    }
+
+    if (m_disk) {
+        m_disk->put(_key, _image.mime + "\n" + _image.data);
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "tools/lru_cache.h"
+#include "tools/disk_cache.h"
+
+// An already encoded picture
+struct CachedImage {
+    std::string mime;
+    std::string data;
+};
+
+// Encoded pictures by request: an in memory LRU bounded by bytes, backed by an
+// optional folder that all the workers of the host share. Thread safe.
+class ImageCache {
+public:
+    ImageCache(size_t _memory_size, const std::string &_disk_path = "", size_t _disk_size = 0);
+    virtual ~ImageCache();
+
+    bool    get(const std::string &_key, CachedImage &_image);
+    void    put(const std::string &_key, const CachedImage &_image);
+
+protected:
+    std::mutex                  m_mutex;
+    LruCache<std::shared_ptr<const CachedImage>> m_memory;
+    std::unique_ptr<DiskCache>  m_disk;
+};
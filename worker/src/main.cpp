@@ -4,12 +4,31 @@
 using namespace prime_server;
 
 //nuts and bolts required
+#include <algorithm>
 #include <functional>
 #include <string>
 #include <csignal>
+#include <cstdlib>
+#include <list>
+#include <thread>
+#include <unistd.h>
+
+#include <curl/curl.h>
 
 // Paparazzi
+#include "context.h"
 #include "paparazzi.h"
+#include "platform_paparazzi.h"
+#include "encoder.h"
+#include "image_cache.h"
+#include "config.h"
+
+//sockets of the encoding stage, removed however the process ends (exit or signal)
+#define ENCODE_SOCKET_PREFIX "/tmp/paparazzi_encode_"
+static void removeEncodeSockets() {
+    for (const char* side : {"in_", "out_"})
+        unlink((ENCODE_SOCKET_PREFIX + std::string(side) + std::to_string(getpid())).c_str());
+}
 
 int main(int argc, char* argv[]) {
     //we need the location of the proxy and the loopback
@@ -20,17 +39,87 @@ int main(int argc, char* argv[]) {
     auto upstream_endpoint = std::string(argv[1]);
     //or returns just location information back to the server
     auto loopback_endpoint = std::string(argv[2]);
+    //the rest are options
+    Config config;
+    if(!config.parse(argc, argv, 3))
+        return EXIT_FAILURE;
+
+    //pictures already taken, shared by the render thread and the encoders
+    std::shared_ptr<ImageCache> cache;
+    if (config.image_cache_size > 0 || !config.image_cache_dir.empty())
+        cache = std::make_shared<ImageCache>(config.image_cache_size, config.image_cache_dir, config.image_cache_dir_size);
+
+    //the encoding stage of the pipeline is private to this process
+    auto encode_upstream_endpoint = "ipc://" ENCODE_SOCKET_PREFIX "in_" + std::to_string(getpid());
+    auto encode_downstream_endpoint = "ipc://" ENCODE_SOCKET_PREFIX "out_" + std::to_string(getpid());
+    std::atexit(removeEncodeSockets);
 
-    //listen for requests
     zmq::context_t context;
-    Paparazzi paparazzi_worker{};
-    worker_t worker(context, upstream_endpoint, "ipc:///dev/null", loopback_endpoint,
-        std::bind(&Paparazzi::work, std::ref(paparazzi_worker), std::placeholders::_1, std::placeholders::_2),
-        std::bind(&Paparazzi::cleanup, std::ref(paparazzi_worker)));
-    worker.work();
 
-    //listen for SIGINT and terminate if we hear it
+    //any encoder is as good as the next one
+    std::thread encode_proxy([&context, encode_upstream_endpoint, encode_downstream_endpoint]() {
+        proxy_t proxy(context, encode_upstream_endpoint, encode_downstream_endpoint,
+            [](const std::list<zmq::message_t>& heart_beats, const std::list<zmq::message_t>& job) -> const zmq::message_t* {
+                return nullptr;
+            });
+        proxy.forward();
+    });
+    encode_proxy.detach();
+
+    //metatiles are sliced and encoded on threads shared by all the encoders (and batches by the slots)
+    auto pool = std::make_shared<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+    //encoders send the final image straight back to the client
+    std::list<std::thread> encoder_threads;
+    for (int i = 0; i < config.encoders; i++) {
+        encoder_threads.emplace_back([&context, encode_downstream_endpoint, loopback_endpoint, cache, pool]() {
+            Encoder encoder(cache, pool);
+            worker_t worker(context, encode_downstream_endpoint, "ipc:///dev/null", loopback_endpoint,
+                std::bind(&Encoder::work, std::ref(encoder), std::placeholders::_1, std::placeholders::_2),
+                std::bind(&Encoder::cleanup, std::ref(encoder)));
+            worker.work();
+        });
+        encoder_threads.back().detach();
+    }
+
+    //url requests, fetched tiles and fonts are shared by all the render slots
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    UrlClient::Options urlClientOptions;
+    urlClientOptions.numberOfThreads = 10;
+    auto platform = std::make_shared<PaparazziPlatform>(urlClientOptions);
+    if (!config.tile_cache_dir.empty())
+        platform->setTileCache(std::make_shared<DiskCache>(config.tile_cache_dir, config.tile_cache_dir_size));
+
+    //the GL contexts are created here, each slot makes its own current on its thread
+#ifdef PLATFORM_RPI
+    config.slots = 1;
+#endif
+    for (int i = 0; i < config.slots; i++)
+        initGL(100, 100, i);
+    releaseGL();
+
+    //listen for requests, every slot pulls from the same endpoint
+    std::list<std::thread> slot_threads;
+    for (int i = 0; i < config.slots; i++) {
+        slot_threads.emplace_back([&context, &config, i, platform, cache, pool, upstream_endpoint, encode_upstream_endpoint, loopback_endpoint]() {
+            makeCurrentGL(i);
+            Paparazzi paparazzi_worker{platform, config, cache, pool};
+            worker_t worker(context, upstream_endpoint, encode_upstream_endpoint, loopback_endpoint,
+                std::bind(&Paparazzi::work, std::ref(paparazzi_worker), std::placeholders::_1, std::placeholders::_2),
+                std::bind(&Paparazzi::cleanup, std::ref(paparazzi_worker)));
+            worker.work();
+        });
+    }
+
+    //listen for SIGINT (and SIGTERM from service managers) and terminate if we hear it
     std::signal(SIGINT, [](int s){ exit(1); });
+    std::signal(SIGTERM, [](int s){ exit(1); });
+
+    for (auto& slot_thread : slot_threads)
+        slot_thread.join();
+
+    closeGL();
+    curl_global_cleanup();
 
     return EXIT_SUCCESS;
 }
@@ -1,145 +1,154 @@
 #include "paparazzi.h"
 
-#define AA_SCALE 2.0
 #define MAX_WAITING_TIME 100.0
+#define MAX_BATCH_VIEWS 100
+#define MAX_BATCH_PIXELS (64 * 1024 * 1024)  // output pixels of all the views of a batch
+#define MAX_PICTURE_SIZE 4096           // pixels per side rendered at once, bigger pictures are tiled
+#define MAX_TILED_PICTURE_SIZE 16384    // pixels per side of a tiled picture
+#define PICTURE_TILE_SIZE 1024          // pixels per side of the tiles of a tiled picture
 
 // #include "platform.h"       // Tangram platform specifics
 // #include "gl.h"
-#include "platform_linux.h" // headless platforms (Linux and RPi)
-std::shared_ptr<LinuxPlatform> platform;
-
 #include "context.h"        // This set the headless context
 
-// MD5
-#include "hash-library/md5.h"
+// Content hash of the POSTed scenes, the same one the proxy routes by
+#include "tools/hash.h"
 
 //nuts and bolts required
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <algorithm>
 #include <csignal>
-#include <fstream>
-#include <regex>
-#include <sstream>
-#include <curl/curl.h>      // Curl
+#include <unistd.h>
 #include "glm/trigonometric.hpp" // GLM for the radians/degree calc
+#include "rapidjson/document.h"     // batch of views
+
+#include "headers.h"         // HTTP response headers
+#include "encoder.h"         // Encoder stage
+#include "tools/png_encoder.h"  // Tiled pictures go straight into a PngWriter
+#include "tools/pixels.h"
+
+// Unique on the cluster: host, process and render slot
+static std::string getWorkerId() {
+    static std::atomic<int> slots(0);
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    return std::string(host) + ":" + std::to_string(getpid()) + ":" + std::to_string(slots++);
+}
 
-// HTTP RESPONSE HEADERS
-const headers_t::value_type CORS{"Access-Control-Allow-Origin", "*"};
-const headers_t::value_type PNG_MIME{"Content-type", "image/png"};
-const headers_t::value_type TXT_MIME{"Content-type", "text/plain;charset=utf-8"};
-
-Paparazzi::Paparazzi() : m_scene("scene.yaml"), m_lat(0.0), m_lon(0.0), m_zoom(0.0f), m_rotation(0.0f), m_tilt(0.0), m_width(100), m_height(100) {
-
-    // Initialize Platform
-    UrlClient::Environment urlClientEnvironment;
-
-    UrlClient::Options urlClientOptions;
-    urlClientOptions.numberOfThreads = 10;
-
-    platform = std::make_shared<LinuxPlatform>(urlClientOptions);
-
-    // Initialize cURL
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-
-    // Start OpenGL ES context
-    initGL(m_width, m_height);
-
-    m_map = std::unique_ptr<Tangram::Map>(new Tangram::Map(platform));
-    m_map->loadSceneAsync(m_scene.c_str());
-    m_map->setupGL();
-    m_map->setPixelScale(AA_SCALE);
-    m_map->resize(m_width*AA_SCALE, m_height*AA_SCALE);
-    update();
+Paparazzi::Paparazzi(std::shared_ptr<PaparazziPlatform> _platform, const Config &_config, std::shared_ptr<ImageCache> _cache, std::shared_ptr<ThreadPool> _pool, const std::string &_scene) : m_id(getWorkerId()), m_width(100), m_height(100), m_metatile(_config.metatile), m_aa(_config.aa), m_platform(std::make_shared<SlotPlatform>(_platform)), m_scenes(_config.scenes), m_cache(_cache), m_pool(_pool) {
 
+    // The GL context of this render slot has to be current on the calling thread
     m_aab = std::unique_ptr<AntiAliasedBuffer>(new AntiAliasedBuffer(m_width, m_height));
-    m_aab->setScale(AA_SCALE);
+    m_aab->setScale(_config.aa_scale);
+    m_aab->setKernel(_config.aa_kernel);
 
-    setSize(800, 600, 1.0);
+    setScene(_scene);
+    setView(ViewState());
 }
 
 Paparazzi::~Paparazzi() {
-    curl_global_cleanup();
-    closeGL();
 }
 
-void Paparazzi::setSize (const int &_width, const int &_height, const float &_density) {
-    if (_density*_width != m_width || _density*_height != m_height || _density*AA_SCALE != m_map->getPixelScale()) {
-        m_width = _width*_density;
-        m_height = _height*_density;
+void Paparazzi::setView (const ViewState &_view) {
+    Tangram::Map &map = *m_current->map;
+    ViewState &view = m_current->view;
 
+    // Antialiasing, it sets the scale the map renders at
+    int aa = _view.aa < 0 ? m_aa : _view.aa;
+    m_aab->setMode(aa);
+    float scale = m_aab->getRenderScale();
+
+    // Size and pixel density
+    m_width = _view.width*_view.density;
+    m_height = _view.height*_view.density;
+    if (_view.width != view.width || _view.height != view.height || _view.density != view.density || aa != view.aa) {
         // Setup the size of the image
-        if (_density*AA_SCALE != m_map->getPixelScale()) {
-            m_map->setPixelScale(_density*AA_SCALE);
+        if (_view.density*scale != map.getPixelScale()) {
+            map.setPixelScale(_view.density*scale);
         }
-        m_map->resize(m_width*AA_SCALE, m_height*AA_SCALE);
-        update();
-
-        m_aab->setSize(m_width, m_height);
+        map.resize(m_width*scale, m_height*scale);
     }
-}
+    // The buffer is shared by all the scenes of the pool (it does nothing if the size is the same)
+    m_aab->setSize(m_width, m_height);
 
-void Paparazzi::setZoom (const float &_zoom) {
-    if (_zoom != m_zoom) {
-        m_zoom = _zoom;
+    // Camera
+    if (_view.lon != view.lon || _view.lat != view.lat) {
+        map.setPosition(_view.lon, _view.lat);
+    }
 
-        m_map->setZoom(_zoom);
-        update();
+    if (_view.zoom != view.zoom) {
+        map.setZoom(_view.zoom);
     }
-}
 
-void Paparazzi::setTilt (const float &_deg) {
-    if (_deg != m_tilt) {
-        m_tilt = _deg;
+    if (_view.tilt != view.tilt) {
+        map.setTilt(glm::radians(_view.tilt));
+    }
 
-        m_map->setTilt(glm::radians(m_tilt));
-        update();
+    if (_view.rotation != view.rotation) {
+        map.setRotation(glm::radians(_view.rotation));
     }
+
+    view = _view;
+    view.aa = aa;
+
+    // One single update for the whole request (scene included)
+    update();
 }
-void Paparazzi::setRotation (const float &_deg) {
-    if (_deg != m_rotation) {
-        m_rotation = _deg;
 
-        m_map->setRotation(glm::radians(m_rotation));
-        update();
+void Paparazzi::setScene (const std::string &_url) {
+    if (!useScene(_url)) {
+        loadScene(_url, _url);
     }
 }
 
-void Paparazzi::setPosition (const double &_lon, const double &_lat) {
-    if (_lon != m_lon || _lat != m_lat) {
-        m_lon = _lon;
-        m_lat = _lat;
-
-        m_map->setPosition(m_lon, m_lat);
-        update();
+void Paparazzi::setSceneContent(const std::string &_yaml_content, const std::string &_hash) {
+    if (!useScene(_hash)) {
+        // The platform serves it from memory, nothing goes to disk
+        loadScene(_hash, m_platform->addScene(_hash, _yaml_content));
     }
 }
 
-void Paparazzi::setScene (const std::string &_url) {
-    if (_url != m_scene) {
-        m_scene = _url;
+bool Paparazzi::useScene(const std::string &_key) {
+    if (m_current && _key == m_scene) {
+        return true;
+    }
 
-        m_map->loadSceneAsync(m_scene.c_str());
-        update();
+    // Still loaded? then it's just a matter of swapping maps
+    std::shared_ptr<LoadedScene> scene;
+    if (m_scenes.get(_key, scene)) {
+        m_scene = _key;
+        m_current = scene;
+        return true;
     }
+    return false;
 }
 
-void Paparazzi::setSceneContent(const std::string &_yaml_content) {
-    MD5 md5;
-    std::string md5_scene =  md5(_yaml_content);
+void Paparazzi::loadScene(const std::string &_key, const std::string &_path) {
+    auto scene = std::make_shared<LoadedScene>();
+    scene->map = std::unique_ptr<Tangram::Map>(new Tangram::Map(m_platform));
+    scene->map->loadSceneAsync(_path.c_str());
+    scene->map->setupGL();
 
-    if (md5_scene != m_scene) {
-        m_scene = md5_scene;
+    // Zero size forces the first setView() to resize the new map
+    scene->view.width = 0;
+    scene->view.height = 0;
 
-        // TODO:
-        //    - This is waiting for LoadSceneConfig to be implemented in Tangram::Map
-        //      Once that's done there is no need to save the file.
-        std::string name = "cache/"+md5_scene+".yaml";
-        std::ofstream out(name.c_str());
-        out << _yaml_content.c_str();
-        out.close();
+    m_scene = _key;
+    m_current = scene;
 
-        m_map->loadSceneAsync(name.c_str());
-        update();
-    }
+    // Every scene counts as one, the least recently used map is released
+    m_scenes.put(_key, scene, 1);
+}
+
+std::string Paparazzi::getHeartBeat() const {
+    std::string heart_beat = m_id;
+    m_scenes.forEach([&heart_beat](const std::string &_key, const std::shared_ptr<LoadedScene> &_scene) {
+        heart_beat += "\n" + _key;
+    });
+    return heart_beat;
 }
 
 void Paparazzi::update () {
@@ -148,16 +157,159 @@ void Paparazzi::update () {
 
     bool bFinish = false;
     while (delta < MAX_WAITING_TIME && !bFinish) {
+        // Remember how many events we have seen before updating
+        unsigned long events = m_platform->getEvents();
+
         // Update Network Queue
-        bFinish = m_map->update(10.);
+        bFinish = m_current->map->update(10.);
         delta = float(getTime() - startTime);
         if (bFinish) {
             logMsg("Tangram::Update: Finish!\n");
+        } else {
+            // Sleep until a tile or a scene arrives instead of spinning
+            m_platform->waitForEvents(events, MAX_WAITING_TIME - delta);
+            delta = float(getTime() - startTime);
         }
     }
     logMsg("Paparazzi::Update: Done waiting...\n");
 }
 
+bool Paparazzi::renderPicture(const ViewState &_view, bool _transparent) {
+    // Move the camera and wait for the tiles
+    setView(_view);
+
+    // Render Tangram Scene
+    m_aab->setTransparent(_transparent);
+    m_aab->bind();
+    m_current->map->render();
+    m_aab->unbind();
+
+    // Once the main FBO is draw start taking the picture
+    return m_aab->requestPixels();
+}
+
+bool Paparazzi::readPicture(PictureCallback _callback) {
+    unsigned int width, height;
+    const unsigned char *pixels = m_aab->mapPixels(width, height);
+    if (pixels) {
+        try {
+            _callback(pixels, width, height);
+        }
+        catch(...) {
+            m_aab->unmapPixels();
+            throw;
+        }
+    }
+    m_aab->unmapPixels();
+    return pixels != nullptr;
+}
+
+bool Paparazzi::takePicture(const ViewState &_view, bool _transparent, PictureCallback _callback) {
+    return takePictures({_view}, _transparent, [&_callback](size_t _index, const unsigned char *_pixels, unsigned int _width, unsigned int _height) {
+        _callback(_pixels, _width, _height);
+    });
+}
+
+bool Paparazzi::takePictures(const std::vector<ViewState> &_views, bool _transparent, PicturesCallback _callback) {
+    // Nothing is left in flight by a job that threw half way
+    m_aab->discardPixels();
+
+    for (size_t i = 0; i <= _views.size(); i++) {
+        // Wait for the tiles of picture i and render it while picture i - 1 is read back,
+        // then map picture i - 1 (its copy is done by now)
+        if (i < _views.size() && !renderPicture(_views[i], _transparent)) {
+            return false;
+        }
+        if (i > 0 && !readPicture([&](const unsigned char *_pixels, unsigned int _width, unsigned int _height) {
+                _callback(i - 1, _pixels, _width, _height);
+            })) {
+            return false;
+        }
+    }
+    return true;
+}
+
+unsigned int Paparazzi::getMaxPictureSize(const ViewState &_view) const {
+    int aa = _view.aa < 0 ? m_aa : _view.aa;
+    return std::min<unsigned int>(MAX_PICTURE_SIZE, m_aab->getMaxSize(aa));
+}
+
+bool Paparazzi::isTiled(const ViewState &_view) const {
+    unsigned int max = getMaxPictureSize(_view);
+    return _view.width*_view.density > max || _view.height*_view.density > max;
+}
+
+bool Paparazzi::takeTiledPicture(const ViewState &_view, bool _transparent, RowsCallback _callback) {
+    int width = _view.width*_view.density;
+    int height = _view.height*_view.density;
+
+    // The tiles only move the camera, so everything is done in pixels of the whole picture
+    // over a flat mercator world of `world` pixels at this zoom and density
+    double world = TILE_SIZE * pow(2.0, _view.zoom) * _view.density;
+    double lat = std::max(-85.0511, std::min(85.0511, _view.lat)) * M_PI / 180.0;
+    double center_x = (_view.lon + 180.0) / 360.0 * world;
+    double center_y = (1.0 - log(tan(lat) + 1.0 / cos(lat)) / M_PI) / 2.0 * world;
+
+    // Tiles row by row, the pixels of each one go to the top left corner of its picture
+    struct Tile {
+        int x0, y0, columns, rows;
+    };
+    // Tiles are rounded up to whole pixels of the view, up to density more
+    int step = std::max(1, std::min<int>(PICTURE_TILE_SIZE, (int)getMaxPictureSize(_view) - 8));
+
+    std::vector<Tile> tiles;
+    std::vector<ViewState> views;
+    for (int y0 = 0; y0 < height; y0 += step) {
+        int rows = std::min(step, height - y0);
+
+        for (int x0 = 0; x0 < width; x0 += step) {
+            int columns = std::min(step, width - x0);
+
+            // At least columns x rows pixels, the picture is cropped to them
+            ViewState tile = _view;
+            tile.width = ceil(columns / _view.density);
+            tile.height = ceil(rows / _view.density);
+            while (int(tile.width*_view.density) < columns) tile.width++;
+            while (int(tile.height*_view.density) < rows) tile.height++;
+            int tile_width = tile.width*_view.density;
+            int tile_height = tile.height*_view.density;
+
+            // Centered on the center of its pixels
+            double x = center_x + x0 + tile_width*0.5 - width*0.5;
+            double y = center_y + y0 + tile_height*0.5 - height*0.5;
+            tile.lon = x / world * 360.0 - 180.0;
+            tile.lat = atan(sinh(M_PI * (1.0 - 2.0 * y / world))) * 180.0 / M_PI;
+
+            tiles.push_back(Tile{x0, y0, columns, rows});
+            views.push_back(tile);
+        }
+    }
+
+    // One band of full rows at a time: memory is bound by the width, not by the area.
+    // The last tile of a band completes it.
+    std::vector<unsigned char> band(width * step * 4);
+    return takePictures(views, _transparent, [&](size_t _index, const unsigned char *_pixels, unsigned int _width, unsigned int _height) {
+        const Tile &tile = tiles[_index];
+        for (int row = 0; row < tile.rows && row < (int)_height; row++) {
+            memcpy(&band[(row*width + tile.x0) * 4], _pixels + row*_width*4, std::min<int>(tile.columns, _width) * 4);
+        }
+        if (tile.x0 + tile.columns == width) {
+            _callback(band.data(), width, tile.rows);
+        }
+    });
+}
+
+// Same picture, same key: only the settings that change the output take part
+static std::string getCacheKey(const std::string &_scene, const ViewState &_view, const ImageOptions &_options, bool _transparent) {
+    bool png = _options.format == IMAGE_FORMAT_PNG || _options.format == IMAGE_FORMAT_PNG8;
+    char params[256];
+    snprintf(params, sizeof(params), "|%d|%d|%.3f|%.9f|%.9f|%.4f|%.3f|%.3f|%d|%u|%d|%u|%d|%d",
+             _view.width, _view.height, _view.density, _view.lon, _view.lat, _view.zoom, _view.tilt, _view.rotation, _view.aa,
+             _options.format, png ? _options.compression : 0, png ? _options.filter : 0, png ? 0 : _options.quality,
+             _transparent ? 1 : 0);
+    return _scene + params;
+}
+
 /**
  * @brief Bounds representation: minx, miny, maxx, maxy
  */
@@ -243,6 +395,223 @@ void futile_bounds_center(futile_bounds_s *bounds, double *x, double*y) {
     *y = bounds->miny + (bounds->maxy-bounds->miny)*0.5;
 }
 
+// The view of a single tile: what the tile route renders and what its cache key is made of.
+// Same center as the tile in a metatile, the midpoint of the latitudes isn't (mercator stretches the north half)
+void Paparazzi::getTileView(uint32_t _x, uint32_t _y, uint32_t _z, ViewState &_view) {
+    getMetatileView(_x, _y, _z, 1, _view);
+}
+
+// The view of a block of _size x _size tiles, centered in mercator space so every tile lands on its own pixels
+void Paparazzi::getMetatileView(uint32_t _x, uint32_t _y, uint32_t _z, uint32_t _size, ViewState &_view) {
+    double n = pow(2.0, _z);
+    double x = _x + _size*0.5;
+    double y = _y + _size*0.5;
+
+    _view.width = TILE_SIZE*_size;
+    _view.height = TILE_SIZE*_size;
+    _view.zoom = _z;
+    _view.lon = x / n * 360.0 - 180.0;
+    _view.lat = radians_to_degrees(atan(sinh(M_PI * (1 - 2 * y / n))));
+}
+
+// Views of a batch, from a JSON array of {"width", "height", "lat", "lon", "zoom", "density", "tilt", "rotation"},
+// in the same ranges as the query parameters
+static double getViewValue(const rapidjson::Value &_view, const char* _name, bool _required, double _default = 0.) {
+    auto member = _view.FindMember(_name);
+    if (member == _view.MemberEnd() || !member->value.IsNumber()) {
+        if (_required)
+            throw std::runtime_error(std::string("every view needs a ") + _name);
+        return _default;
+    }
+    return Request::checkViewValue(_name, member->value.GetDouble());
+}
+
+// Same zoom together, then along a Z curve so neighbouring views share their tiles
+static uint64_t getViewOrder(const ViewState &_view) {
+    double x = (_view.lon + 180.0) / 360.0;
+    double lat = std::max(-85.0511, std::min(85.0511, _view.lat)) * M_PI / 180.0;
+    double y = (1.0 - log(tan(lat) + 1.0 / cos(lat)) / M_PI) / 2.0;
+    uint32_t ix = std::min(65535., std::max(0., x * 65536.));
+    uint32_t iy = std::min(65535., std::max(0., y * 65536.));
+
+    uint64_t morton = 0;
+    for (int bit = 0; bit < 16; bit++) {
+        morton |= (uint64_t)((ix >> bit) & 1) << (2 * bit);
+        morton |= (uint64_t)((iy >> bit) & 1) << (2 * bit + 1);
+    }
+    return ((uint64_t)std::max(0, (int)lround(_view.zoom)) << 32) | morton;
+}
+
+void Paparazzi::renderBatch(const Request &_request, http_response_t &_response) {
+    if (_request.scene.empty())
+        throw std::runtime_error("scene is required punk");
+    std::string scene = _request.scene.str();
+
+    rapidjson::Document document;
+    std::string json = _request.body.str();
+    document.Parse(json.c_str());
+    if (document.HasParseError() || !document.IsArray() || document.Size() == 0)
+        throw std::runtime_error("batch needs a JSON array of views");
+    if (document.Size() > MAX_BATCH_VIEWS)
+        throw std::runtime_error("batch is limited to " + std::to_string(MAX_BATCH_VIEWS) + " views");
+
+    std::vector<ViewState> views(document.Size());
+    double pixels = 0.;
+    for (rapidjson::SizeType i = 0; i < document.Size(); i++) {
+        const rapidjson::Value &item = document[i];
+        if (!item.IsObject())
+            throw std::runtime_error("batch needs a JSON array of views");
+
+        ViewState &view = views[i];
+        view.width = getViewValue(item, "width", true);
+        view.height = getViewValue(item, "height", true);
+        view.lat = getViewValue(item, "lat", true);
+        view.lon = getViewValue(item, "lon", true);
+        view.zoom = getViewValue(item, "zoom", true);
+        view.density = getViewValue(item, "density", false, 1.);
+        view.tilt = getViewValue(item, "tilt", false);
+        view.rotation = getViewValue(item, "rotation", false);
+        view.aa = _request.aa < 0 ? m_aa : _request.aa;
+        if (isTiled(view))
+            throw std::runtime_error("batch views are limited to " + std::to_string(getMaxPictureSize(view)) + " pixels per side");
+
+        pixels += view.width * view.density * view.height * view.density;
+        if (pixels > MAX_BATCH_PIXELS)
+            throw std::runtime_error("batch is limited to " + std::to_string(MAX_BATCH_PIXELS) + " pixels in total");
+    }
+
+    // The pictures already taken come from the cache, the others are rendered
+    std::vector<CachedImage> images(views.size());
+    std::vector<std::string> keys(views.size());
+    std::vector<size_t> order;
+    for (size_t i = 0; i < views.size(); i++) {
+        if (m_cache) {
+            keys[i] = getCacheKey(scene, views[i], _request.options, _request.transparent);
+            if (m_cache->get(keys[i], images[i]))
+                continue;
+        }
+        order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&views](size_t _a, size_t _b) {
+        return getViewOrder(views[_a]) < getViewOrder(views[_b]);
+    });
+
+    if (!order.empty()) {
+        // Back to back on the same map. Every picture read back is copied and encoded on the pool
+        // while the next one renders, with no more raw pictures waiting than there are encoders
+        setScene(scene);
+        std::vector<ViewState> ordered;
+        for (size_t i : order)
+            ordered.push_back(views[i]);
+
+        if (!ImageEncoder::create(_request.options.format))
+            throw std::runtime_error("unknown image format");
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        size_t pending = 0;
+        bool failed = false;
+        const size_t max_pending = m_pool ? m_pool->getThreads() + 1 : 1;
+        auto wait = [&](size_t _pending) {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&]() { return pending <= _pending; });
+        };
+
+        auto encode = [&](size_t _i, std::shared_ptr<std::vector<unsigned char>> _pixels, unsigned int _width, unsigned int _height) {
+            bool encoded = false;
+            try {
+                std::unique_ptr<ImageEncoder> encoder = ImageEncoder::create(_request.options.format);
+                encoded = encoder->encode(images[_i].data, _pixels->data(), _width, _height, 4, _request.options);
+                images[_i].mime = encoder->getMime();
+                if (encoded && m_cache)
+                    m_cache->put(keys[_i], images[_i]);
+            }
+            catch(const std::exception&) {
+                encoded = false;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = failed || !encoded;
+            pending--;
+            condition.notify_all();
+        };
+
+        bool taken = false;
+        try {
+            taken = takePictures(ordered, _request.transparent, [&](size_t _index, const unsigned char *_pixels, unsigned int _width, unsigned int _height) {
+                wait(max_pending - 1);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    pending++;
+                }
+                auto pixels = std::make_shared<std::vector<unsigned char>>(_pixels, _pixels + _width * _height * 4);
+                size_t i = order[_index];
+                if (m_pool)
+                    m_pool->post([encode, i, pixels, _width, _height]() { encode(i, pixels, _width, _height); });
+                else
+                    encode(i, pixels, _width, _height);
+            });
+        }
+        catch(...) {
+            // the encodes still running write into this frame
+            wait(0);
+            throw;
+        }
+
+        // The response is put together once the last picture is encoded
+        wait(0);
+        if (!taken)
+            throw std::runtime_error("couldn't read the image back");
+        if (failed)
+            throw std::runtime_error("couldn't encode the image");
+    }
+
+    // One part per image, in the order of the request
+    std::string boundary = "paparazzi_" + toHex(hash64(images.front().data));
+    std::string body;
+    for (const auto &image : images) {
+        body += "--" + boundary + "\r\n";
+        body += "Content-Type: " + image.mime + "\r\n";
+        body += "Content-Length: " + std::to_string(image.data.size()) + "\r\n\r\n";
+        body += image.data;
+        body += "\r\n";
+    }
+    body += "--" + boundary + "--\r\n";
+    _response = http_response_t(200, "OK", body, headers_t{CORS, {"Content-type", "multipart/mixed; boundary=" + boundary}});
+}
+
+void Paparazzi::renderTiled(const ViewState &_view, bool _transparent, const ImageOptions &_options, std::string &_image) {
+    int width = _view.width*_view.density;
+    int height = _view.height*_view.density;
+    if (width > MAX_TILED_PICTURE_SIZE || height > MAX_TILED_PICTURE_SIZE)
+        throw std::runtime_error("pictures are limited to " + std::to_string(MAX_TILED_PICTURE_SIZE) + " pixels per side");
+    if (_options.format != IMAGE_FORMAT_PNG)
+        throw std::runtime_error("pictures over " + std::to_string(getMaxPictureSize(_view)) + " pixels per side can only be png");
+    if (_view.tilt != 0.f || _view.rotation != 0.f)
+        throw std::runtime_error("pictures over " + std::to_string(getMaxPictureSize(_view)) + " pixels per side can't be tilted or rotated");
+
+    // Opaque pictures are written without alpha, like the encoder stage does
+    unsigned int depth = _transparent ? 4 : 3;
+    std::vector<unsigned char> row(width * 3);
+    PngWriter writer(_image, width, height, depth, _options.compression, _options.filter);
+    bool written = true;
+    bool taken = takeTiledPicture(_view, _transparent, [&](const unsigned char *_rows, unsigned int _width, unsigned int _count) {
+        if (_transparent) {
+            written = written && writer.writeRows(_rows, _count, _width * 4);
+        } else {
+            for (unsigned int y = 0; y < _count && written; y++) {
+                rgbaToRgb(_rows + y * _width * 4, _width, row.data());
+                written = writer.writeRow(row.data());
+            }
+        }
+    });
+
+    if (!taken)
+        throw std::runtime_error("couldn't read the image back");
+    if (!written || !writer.finish())
+        throw std::runtime_error("couldn't encode the image");
+}
+
 // prime_server stuff
 worker_t::result_t Paparazzi::work (const std::list<zmq::message_t>& job, void* request_info){
     //false means this is going back to the client, there is no next stage of the pipeline
@@ -256,137 +625,156 @@ worker_t::result_t Paparazzi::work (const std::list<zmq::message_t>& job, void*
     try {
         // double start_call = getTime();
 
-        //TODO: 
-        //   - actually use/validate the request parameters
-        auto request = http_request_t::from_string(static_cast<const char*>(job.front().data()), job.front().size());
+        Request request;
+        request.parse(static_cast<const char*>(job.front().data()), job.front().size());
 
-        if (request.path == "/check") {
+        if (request.route == Request::ROUTE_CHECK) {
             // ELB check
             response = http_response_t(200, "OK", "OK", headers_t{CORS, TXT_MIME});
+        } else if (request.route == Request::ROUTE_BATCH) {
+            // Many views of one scene, answered all together
+            renderBatch(request, response);
         } else {
             //  SCENE
             //  ---------------------
-            auto scene_itr = request.query.find("scene");
-            if (scene_itr == request.query.cend() || scene_itr->second.size() == 0) {
+            std::string scene;          // url or SHA-256 of the POSTed scene
+            bool scene_posted = false;
+            if (request.scene.empty()) {
                 // If there is NO SCENE QUERY value 
                 if (request.body.empty()) 
                     // if there is not POST body content return error...
                     throw std::runtime_error("scene is required punk");
 
-                // ... other whise load content
-                setSceneContent(request.body);
-                // The size of the custom scene is unique enough
-                result.heart_beat = std::to_string(request.body.size());
+                // ... other whise it will load the content
+                scene = sha256Hex(request.body.data, request.body.size);
+                scene_posted = true;
             }
             else {
-                // If there IS a SCENE QUERRY value load it
-                setScene(scene_itr->second.front());
-                result.heart_beat = scene_itr->second.front();
+                // If there IS a SCENE QUERRY value it will load it
+                scene = request.scene.str();
             }
 
-            bool size_and_pos = true;
-            float pixel_density = 1.0f;
-
-            //  SIZE
-            //  ---------------------
-            auto width_itr = request.query.find("width");
-            if (width_itr == request.query.cend() || width_itr->second.size() == 0)
-                size_and_pos = false;
-            auto height_itr = request.query.find("height");
-            if (height_itr == request.query.cend() || height_itr->second.size() == 0)
-                size_and_pos = false;
-            auto density_itr = request.query.find("density");
-            if (density_itr != request.query.cend() && density_itr->second.size() > 0)
-                pixel_density = fmax(1.,std::stof(density_itr->second.front()));
-            //  POSITION
+            //  SIZE, POSITION, tilt and rotation
             //  ---------------------
-            auto lat_itr = request.query.find("lat");
-            if (lat_itr == request.query.cend() || lat_itr->second.size() == 0)
-                size_and_pos = false;
-            auto lon_itr = request.query.find("lon");
-            if (lon_itr == request.query.cend() || lon_itr->second.size() == 0)
-                size_and_pos = false;
-            auto zoom_itr = request.query.find("zoom");
-            if (zoom_itr == request.query.cend() || zoom_itr->second.size() == 0)
-                size_and_pos = false;
-            
-
-            if (size_and_pos) {
-                // Set Map and OpenGL context size
-                setSize(std::stoi(width_itr->second.front()), std::stoi(height_itr->second.front()), pixel_density);
-                setPosition(std::stod(lon_itr->second.front()), std::stod(lat_itr->second.front()));
-                setZoom(std::stof(zoom_itr->second.front()));
+            bool is_tile = request.route == Request::ROUTE_TILE;
+            ViewState view;
+            view.density = request.density;
+            if (is_tile) {
+                getTileView(request.tile_x, request.tile_y, request.tile_z, view);
             } else {
-                const std::regex re("\\/(\\d*)\\/(\\d*)\\/(\\d*)\\.png");
-                std::smatch match;
-
-                if (std::regex_search(request.path, match, re) && match.size() == 4) {
-                    setSize(256,256, pixel_density);
-
-                    int tile_coord[3] = {0,0,0};
-                    for (int i = 0; i < 3; i++) {
-                        std::istringstream cur(match.str(i+1));
-                        cur >> tile_coord[i];
-                    }
-                    futile_coord_s tile;
-                    tile.z = tile_coord[0];
-                    setZoom(tile.z);
-
-                    tile.x = tile_coord[1];
-                    tile.y = tile_coord[2];
-                    futile_bounds_s bounds;
-                    futile_coord_to_bounds(&tile, &bounds);
-
-                    setPosition(bounds.minx + (bounds.maxx-bounds.minx)*0.5,bounds.miny + (bounds.maxy-bounds.miny)*0.5);
-                }
-                else {
-                    throw std::runtime_error("not enought data to construct image");
-                }
+                view.width = request.width;
+                view.height = request.height;
+                view.lon = request.lon;
+                view.lat = request.lat;
+                view.zoom = request.zoom;
             }
+            view.tilt = request.tilt;
+            view.rotation = request.rotation;
+            view.aa = request.aa < 0 ? m_aa : request.aa;
 
-            //  OPTIONAL tilt and rotation
+            //  OPTIONAL image encoding
             //  ---------------------
-            auto tilt_itr = request.query.find("tilt");
-            if (tilt_itr != request.query.cend() && tilt_itr->second.size() != 0) {
-                // If TILT QUERRY is provided assigned ...
-                setTilt(std::stof(tilt_itr->second.front()));
-            }
-            else {
-                // othewise use default (0.)
-                setTilt(0.0f);
+            const ImageOptions &options = request.options;
+            bool transparent = request.transparent;
+
+            // Already took this picture?
+            //  ---------------------
+            std::string key;
+            CachedImage cached;
+            if (m_cache) {
+                key = getCacheKey(scene, view, options, transparent);
             }
 
-            auto rotation_itr = request.query.find("rotation");
-            if (rotation_itr != request.query.cend() && rotation_itr->second.size() != 0) {
-                // If ROTATION QUERRY is provided assigned ...
-                setRotation(std::stof(rotation_itr->second.front()));
+            if (m_cache && m_cache->get(key, cached)) {
+                response = http_response_t(200, "OK", cached.data, headers_t{CORS, {"Content-type", cached.mime}});
             }
             else {
-                // othewise use default (0.)
-                setRotation(0.0f);
-            }
+                // Time to render
+                //  ---------------------
+                if (scene_posted)
+                    setSceneContent(request.body.str(), scene);
+                else
+                    setScene(scene);
+
+                // Too big for a single framebuffer: render it in tiles, streaming their rows into the PNG
+                //  ---------------------
+                if (isTiled(view)) {
+                    std::string image;
+                    renderTiled(view, transparent, options, image);
+                    if (m_cache)
+                        m_cache->put(key, CachedImage{"image/png", image});
+
+                    response = http_response_t(200, "OK", image, headers_t{CORS, {"Content-type", "image/png"}});
+                    response.from_info(info);
+                    result.messages.emplace_back(response.to_string());
+                    result.heart_beat = getHeartBeat();
+                    return result;
+                }
+
+                // Metatiles: render the block of tiles around this one in a single pass,
+                // the siblings go to the cache with the same keys a request for them would use
+                //  ---------------------
+                uint32_t metatile = 1;
+                uint32_t tile_index = 0;
+                std::string keys = key;
+                ViewState render_view = view;
+                if (is_tile && m_cache && m_metatile > 1 && view.tilt == 0.f && view.rotation == 0.f) {
+                    // The parser already checked the tile is on the grid
+                    const futile_coord_s tile = {request.tile_x, request.tile_y, request.tile_z};
+                    uint32_t tiles = 1u << tile.z;
+                    metatile = std::min<uint32_t>(m_metatile, tiles);
+                    unsigned int max = std::min<unsigned int>(MAX_METATILE_SIZE, getMaxPictureSize(view));
+                    while (metatile > 1 && TILE_SIZE*metatile*view.density > max)
+                        metatile--;
+
+                    if (metatile > 1) {
+                        uint32_t x0 = std::min(tile.x / metatile * metatile, tiles - metatile);
+                        uint32_t y0 = std::min(tile.y / metatile * metatile, tiles - metatile);
+                        keys.clear();
+                        for (uint32_t row = 0; row < metatile; row++) {
+                            for (uint32_t column = 0; column < metatile; column++) {
+                                ViewState sibling_view = view;
+                                getTileView(x0 + column, y0 + row, tile.z, sibling_view);
+                                if (row > 0 || column > 0)
+                                    keys += '\0';
+                                keys += getCacheKey(scene, sibling_view, options, transparent);
+                            }
+                        }
+                        tile_index = (tile.y - y0)*metatile + (tile.x - x0);
+                        getMetatileView(x0, y0, tile.z, metatile, render_view);
+                    }
+                }
+
+                RawImageHeader header;
+                header.depth = 4;
+                header.columns = metatile;
+                header.rows = metatile;
+                header.tile = tile_index;
+                header.options = options;
+
+                std::string raw;
+                if (!takePicture(render_view, transparent, [&](const unsigned char *_pixels, unsigned int _width, unsigned int _height) {
+                        header.width = _width;
+                        header.height = _height;
+                        Encoder::makeRawImage(raw, header, keys, _pixels);
+                    }))
+                    throw std::runtime_error("couldn't read the image back");
 
-            // Time to render
-            //  ---------------------
-            std::string image;
-            if (m_map) {
-                update();
-
-                // Render Tangram Scene
-                m_aab->bind();
-                m_map->render();
-                m_aab->unbind();
-   
-                // Once the main FBO is draw take a picture
-                m_aab->getPixelsAsString(image);
                 // double total_time = getTime()-start_call;
                 // LOG("TOTAL CALL: %f", total_time);
                 // LOG("TOTAL speed: %f millisec per pixel", (total_time/((m_width * m_height)/1000.0)));
-            }
 
-            response = http_response_t(200, "OK", image, headers_t{CORS, PNG_MIME});
+                // Hand the raw pixels to the encoder stage and move on to the next job
+                result.intermediate = true;
+                result.heart_beat = getHeartBeat();
+                result.messages.emplace_back(std::move(raw));
+                return result;
+            }
         }
     }
+    catch(const MethodNotAllowed& e) {
+        response = http_response_t(405, "Method Not Allowed", e.what(), headers_t{CORS, {"Allow", e.allow}});
+    }
     catch(const std::exception& e) {
         //complain
         response = http_response_t(400, "Bad Request", e.what(), headers_t{CORS});
@@ -397,6 +785,7 @@ worker_t::result_t Paparazzi::work (const std::list<zmq::message_t>& job, void*
 
     //formats the response to protocal that the client will understand
     result.messages.emplace_back(response.to_string());
+    result.heart_beat = getHeartBeat();
     return result;
 }
 
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 //prime_server guts
 #include <prime_server/prime_server.hpp>
@@ -9,20 +11,69 @@
 using namespace prime_server;
 
 #include "tools/aab.h"  // AntiAliased Buffer
+#include "image_cache.h"
+#include "config.h"
+#include "request.h"
+#include "tools/lru_cache.h"
+#include "tools/thread_pool.h"
+#include "platform_paparazzi.h"
 #include "tangram.h"    // Tangram-ES
 
+#define TILE_SIZE 256
+#define MAX_METATILE_SIZE 4096  // pixels per side of a metatile picture
+
+// Size and camera of a single picture
+struct ViewState {
+    int     width       = 800;
+    int     height      = 600;
+    float   density     = 1.0f;
+    double  lon         = 0.0;
+    double  lat         = 0.0;
+    float   zoom        = 0.0f;
+    float   tilt        = 0.0f;     // degrees
+    float   rotation    = 0.0f;     // degrees
+    int     aa          = -1;       // AA_* antialiasing mode, -1 for the worker default
+};
+
 class Paparazzi {
 public:
-    Paparazzi();
+    // One per render slot, all of them sharing the same platform (url requests, tile cache, fonts).
+    // Each slot wraps it on its own SlotPlatform, so it only wakes up for its own maps.
+    // _scene is loaded right away, so a slot that only ever renders one scene loads nothing else.
+    // The pictures of a batch are encoded on _pool, shared with the encoders (or here without one).
+    Paparazzi(std::shared_ptr<PaparazziPlatform> _platform, const Config &_config = Config(), std::shared_ptr<ImageCache> _cache = nullptr,
+              std::shared_ptr<ThreadPool> _pool = nullptr, const std::string &_scene = "scene.yaml");
     ~Paparazzi();
 
-    void    setSize(const int &_width, const int &_height, const float &_density);
-    void    setZoom(const float &_zoom);
-    void    setTilt(const float &_deg);
-    void    setRotation(const float &_deg);
+    // Apply all the changes from the current view in one transaction (one resize, one update)
+    void    setView(const ViewState &_view);
+    // Switch to a scene, reusing its map when it is still on the pool
     void    setScene(const std::string &_url);
-    void    setSceneContent(const std::string &_yaml_content);
-    void    setPosition(const double &_lon, const double &_lat);
+    void    setSceneContent(const std::string &_yaml_content, const std::string &_hash);
+
+    // Render the current scene from _view and hand the RGBA pixels (top row first) to _callback.
+    // This is all it takes to render without prime_server.
+    typedef std::function<void(const unsigned char *_pixels, unsigned int _width, unsigned int _height)> PictureCallback;
+    bool    takePicture(const ViewState &_view, bool _transparent, PictureCallback _callback);
+
+    // Same for many views, back to back: every picture is read back while the next one
+    // renders, and handed to _callback with its index, in order.
+    typedef std::function<void(size_t _index, const unsigned char *_pixels, unsigned int _width, unsigned int _height)> PicturesCallback;
+    bool    takePictures(const std::vector<ViewState> &_views, bool _transparent, PicturesCallback _callback);
+
+    // Pictures too big for a single framebuffer are rendered in tiles, moving the camera over
+    // the picture (no tilt or rotation). _callback gets bands of full rows, top first, so
+    // memory is bound by the width of the picture and not by its area.
+    typedef std::function<void(const unsigned char *_rows, unsigned int _width, unsigned int _count)> RowsCallback;
+    // Largest side rendered at once: MAX_PICTURE_SIZE, or less where the GL limits can't hold it
+    // at the antialiasing scale of _view
+    unsigned int getMaxPictureSize(const ViewState &_view) const;
+    bool    isTiled(const ViewState &_view) const;
+    bool    takeTiledPicture(const ViewState &_view, bool _transparent, RowsCallback _callback);
+
+    // Views of a single tile (as the /{z}/{x}/{y} route renders it) and of a block of _size x _size tiles
+    static void getTileView(uint32_t _x, uint32_t _y, uint32_t _z, ViewState &_view);
+    static void getMetatileView(uint32_t _x, uint32_t _y, uint32_t _z, uint32_t _size, ViewState &_view);
 
     // prime_server stuff
     worker_t::result_t work (const std::list<zmq::message_t>& job, void* request_info);
@@ -31,15 +82,38 @@ public:
 protected:
     void    update();
 
+    // Render _view and start reading it back, then hand the oldest read back to _callback
+    bool    renderPicture(const ViewState &_view, bool _transparent);
+    bool    readPicture(PictureCallback _callback);
+
+    // POST /batch?scene=URL with a JSON array of views, encoded on the pool as they are read back
+    void    renderBatch(const Request &_request, http_response_t &_response);
+
+    // A tiled picture encoded as PNG while it is rendered, no encoder stage
+    void    renderTiled(const ViewState &_view, bool _transparent, const ImageOptions &_options, std::string &_image);
+
+    // A loaded scene: its own map and the view it was left at
+    struct LoadedScene {
+        std::unique_ptr<Tangram::Map>   map;
+        ViewState                       view;
+    };
+    bool    useScene(const std::string &_key);
+    void    loadScene(const std::string &_key, const std::string &_path);
+
+    // Worker id followed by the loaded scenes, one per line
+    std::string getHeartBeat() const;
+
+    std::string         m_id;
     std::string         m_scene;
-    double              m_lat;
-    double              m_lon;
-    float               m_zoom;
-    float               m_rotation;
-    float               m_tilt;
-    int                 m_width;
-    int                 m_height;
-
-    std::unique_ptr<Tangram::Map>       m_map;  // Tangram Map instance
+    int                 m_width;    // width in pixels (width * density)
+    int                 m_height;   // height in pixels (height * density)
+    int                 m_metatile; // tiles per side rendered together on the tile route
+    int                 m_aa;       // antialiasing of the views that don't set one
+
+    std::shared_ptr<SlotPlatform>       m_platform; // Events of the maps of this slot
+    std::shared_ptr<LoadedScene>        m_current;  // Scene (and Tangram Map instance) in use
+    LruCache<std::shared_ptr<LoadedScene>> m_scenes;// Recently used scenes, keyed by url or content hash
     std::unique_ptr<AntiAliasedBuffer>  m_aab;  // Antialiased Buffer
+    std::shared_ptr<ImageCache>         m_cache;// Encoded pictures
+    std::shared_ptr<ThreadPool>         m_pool; // Encoders of the batch pictures
 };
@@ -0,0 +1,312 @@
+#include "platform_paparazzi.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TILE_CACHE_THREADS 2
+#define SCENES_SIZE (32 * 1024 * 1024)  // bytes of POSTed scenes kept in memory
+#define SCENES_PATH "memory/"           // virtual folder of the POSTed scenes
+
+// Scenes change often and are cheap to fetch, anything else (tiles, textures, fonts) is kept
+static bool isCacheable(const std::string &_url) {
+    if (_url.compare(0, 7, "http://") != 0 && _url.compare(0, 8, "https://") != 0) {
+        return false;
+    }
+
+    std::string path = _url.substr(0, _url.find('?'));
+    return !(path.size() > 5 && path.compare(path.size() - 5, 5, ".yaml") == 0) &&
+           !(path.size() > 4 && path.compare(path.size() - 4, 4, ".yml") == 0);
+}
+
+static bool isFont(const std::string &_path) {
+    std::string ext = _path.substr(_path.find_last_of('.') + 1);
+    return ext == "ttf" || ext == "otf" || ext == "ttc";
+}
+
+static bool isLocal(const std::string &_url) {
+    return _url.compare(0, 7, "file://") == 0 || _url.compare(0, 10, "mbtiles://") == 0;
+}
+
+static bool readFile(const std::string &_path, std::vector<char> &_data) {
+    int fd = open(_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    if (st.st_size == 0) {
+        close(fd);
+        _data.clear();
+        return true;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    _data.assign((const char*)map, (const char*)map + st.st_size);
+    munmap(map, st.st_size);
+    return true;
+}
+
+PaparazziPlatform::PaparazziPlatform(UrlClient::Options _urlClientOptions) : LinuxPlatform(_urlClientOptions), m_cache_running(true), m_scenes(SCENES_SIZE) {
+    for (int i = 0; i < TILE_CACHE_THREADS; i++) {
+        m_cache_threads.emplace_back(&PaparazziPlatform::read, this);
+    }
+}
+
+PaparazziPlatform::~PaparazziPlatform() {
+    {
+        std::lock_guard<std::mutex> lock(m_cache_mutex);
+        m_cache_running = false;
+    }
+    m_cache_condition.notify_all();
+    for (auto &thread : m_cache_threads) {
+        thread.join();
+    }
+}
+
+void PaparazziPlatform::setTileCache(std::shared_ptr<DiskCache> _cache) {
+    m_tile_cache = _cache;
+}
+
+bool PaparazziPlatform::startUrlRequest(const std::string &_url, Tangram::UrlCallback _callback) {
+    if (!isLocal(_url) && (!m_tile_cache || !isCacheable(_url))) {
+        return fetch(_url, _callback);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_cache_mutex);
+        m_cache_requests.push_back({ _url, _callback });
+    }
+    m_cache_condition.notify_one();
+    return true;
+}
+
+void PaparazziPlatform::cancelUrlRequest(const std::string &_url) {
+    Tangram::UrlCallback callback;
+    {
+        std::lock_guard<std::mutex> lock(m_cache_mutex);
+        for (auto it = m_cache_requests.begin(); it != m_cache_requests.end(); ++it) {
+            if (it->url == _url) {
+                callback = it->callback;
+                m_cache_requests.erase(it);
+                break;
+            }
+        }
+    }
+
+    if (callback) {
+        // Still waiting for the disk, answer it as UrlClient does with canceled requests
+        callback(std::vector<char>());
+    } else {
+        LinuxPlatform::cancelUrlRequest(_url);
+    }
+}
+
+std::string PaparazziPlatform::addScene(const std::string &_hash, const std::string &_content) {
+    std::lock_guard<std::mutex> lock(m_scenes_mutex);
+
+    // Seen before? then there is nothing to copy
+    std::shared_ptr<const std::string> content;
+    if (!m_scenes.get(_hash, content)) {
+        m_scenes.put(_hash, std::make_shared<const std::string>(_content), _content.size());
+    }
+    return SCENES_PATH + _hash + ".yaml";
+}
+
+bool PaparazziPlatform::getScene(const std::string &_path, std::shared_ptr<const std::string> &_content) const {
+    // Tangram may hand the path back resolved (file:///cwd/memory/<hash>.yaml)
+    size_t folder = _path.rfind(SCENES_PATH);
+    if (folder == std::string::npos || (folder > 0 && _path[folder - 1] != '/')) {
+        return false;
+    }
+
+    std::string hash = _path.substr(folder + strlen(SCENES_PATH));
+    if (hash.size() < 5 || hash.compare(hash.size() - 5, 5, ".yaml") != 0) {
+        return false;
+    }
+    hash.resize(hash.size() - 5);
+
+    std::lock_guard<std::mutex> lock(m_scenes_mutex);
+    return m_scenes.get(hash, _content);
+}
+
+std::string PaparazziPlatform::stringFromFile(const char* _path) const {
+    std::shared_ptr<const std::string> content;
+    if (getScene(_path, content)) {
+        return *content;
+    }
+    return LinuxPlatform::stringFromFile(_path);
+}
+
+std::vector<char> PaparazziPlatform::bytesFromFile(const char* _path) const {
+    std::string path(_path);
+    std::shared_ptr<const std::string> content;
+    if (getScene(path, content)) {
+        return std::vector<char>(content->begin(), content->end());
+    }
+
+    if (!isFont(path)) {
+        return LinuxPlatform::bytesFromFile(_path);
+    }
+
+    std::lock_guard<std::mutex> lock(m_fonts_mutex);
+    auto it = m_fonts.find(path);
+    if (it != m_fonts.end()) {
+        return it->second;
+    }
+
+    std::vector<char> data = LinuxPlatform::bytesFromFile(_path);
+    if (!data.empty()) {
+        m_fonts[path] = data;
+    }
+    return data;
+}
+
+bool PaparazziPlatform::fetch(const std::string &_url, Tangram::UrlCallback _callback) {
+    std::shared_ptr<DiskCache> cache = isCacheable(_url) ? m_tile_cache : nullptr;
+    return LinuxPlatform::startUrlRequest(_url, [_url, cache, _callback](std::vector<char>&& _data) {
+        if (cache && !_data.empty()) {
+            cache->put(_url, _data.data(), _data.size());
+        }
+        _callback(std::move(_data));
+    });
+}
+
+void PaparazziPlatform::read() {
+    while (true) {
+        CacheRequest request;
+        {
+            std::unique_lock<std::mutex> lock(m_cache_mutex);
+            m_cache_condition.wait(lock, [&]{ return !m_cache_running || !m_cache_requests.empty(); });
+            if (!m_cache_running) {
+                return;
+            }
+            request = std::move(m_cache_requests.front());
+            m_cache_requests.pop_front();
+        }
+
+        std::vector<char> data;
+        if (isLocal(request.url)) {
+            // An empty response tells Tangram the tile is not there
+            if (!readLocal(request.url, data)) {
+                data.clear();
+            }
+            request.callback(std::move(data));
+        } else if (m_tile_cache->get(request.url, data)) {
+            request.callback(std::move(data));
+        } else {
+            fetch(request.url, request.callback);
+        }
+    }
+}
+
+bool PaparazziPlatform::readLocal(const std::string &_url, std::vector<char> &_data) {
+    std::string url = _url.substr(0, _url.find('?'));
+
+    if (url.compare(0, 7, "file://") == 0) {
+        return readFile(url.substr(7), _data);
+    }
+
+    // mbtiles://[path].mbtiles/[z]/[x]/[y](.ext)
+    std::string path = url.substr(10);
+    size_t end = path.find(".mbtiles/");
+    if (end == std::string::npos) {
+        return false;
+    }
+    end += 8;
+
+    unsigned int z, x, y;
+    if (sscanf(path.c_str() + end, "/%u/%u/%u", &z, &x, &y) != 3) {
+        return false;
+    }
+    path = path.substr(0, end);
+
+    std::shared_ptr<Archive> archive;
+    {
+        std::lock_guard<std::mutex> lock(m_archives_mutex);
+        auto &entry = m_archives[path];
+        if (!entry) {
+            entry = std::make_shared<Archive>();
+        }
+        archive = entry;
+    }
+
+    // Open every archive once and keep it
+    std::call_once(archive->opened, [&]() {
+        archive->mbtiles = std::unique_ptr<MBTiles>(new MBTiles(path));
+    });
+    return archive->mbtiles->getTile(z, x, y, _data);
+}
+
+// Its own url client is never used, all the requests go through the shared one
+static UrlClient::Options getSlotUrlClientOptions() {
+    UrlClient::Options options;
+    options.numberOfThreads = 1;
+    return options;
+}
+
+SlotPlatform::SlotPlatform(std::shared_ptr<PaparazziPlatform> _shared) : LinuxPlatform(getSlotUrlClientOptions()), m_shared(_shared), m_events(std::make_shared<Events>()) {
+}
+
+SlotPlatform::~SlotPlatform() {
+}
+
+void SlotPlatform::requestRender() const {
+    // Tangram request a new frame every time a tile or a scene of one of our maps is ready.
+    // There is no window to redraw, just wake up the slot if it is waiting for it.
+    m_events->notify();
+}
+
+bool SlotPlatform::startUrlRequest(const std::string &_url, Tangram::UrlCallback _callback) {
+    std::shared_ptr<Events> events = m_events;
+    return m_shared->startUrlRequest(_url, [events, _callback](std::vector<char>&& _data) {
+        _callback(std::move(_data));
+        events->notify();
+    });
+}
+
+void SlotPlatform::cancelUrlRequest(const std::string &_url) {
+    m_shared->cancelUrlRequest(_url);
+}
+
+std::string SlotPlatform::stringFromFile(const char* _path) const {
+    return m_shared->stringFromFile(_path);
+}
+
+std::vector<char> SlotPlatform::bytesFromFile(const char* _path) const {
+    return m_shared->bytesFromFile(_path);
+}
+
+unsigned long SlotPlatform::getEvents() const {
+    std::lock_guard<std::mutex> lock(m_events->mutex);
+    return m_events->count;
+}
+
+bool SlotPlatform::waitForEvents(unsigned long _events, double _timeout) const {
+    std::unique_lock<std::mutex> lock(m_events->mutex);
+    return m_events->condition.wait_for(lock, std::chrono::duration<double>(_timeout), [&]{ return m_events->count != _events; });
+}
+
+void SlotPlatform::Events::notify() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        count++;
+    }
+    // A single render thread waits on it
+    condition.notify_one();
+}
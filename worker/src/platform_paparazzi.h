@@ -0,0 +1,115 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "platform_linux.h" // headless platforms (Linux and RPi)
+#include "tools/disk_cache.h"
+#include "tools/lru_cache.h"
+#include "tools/mbtiles.h"
+
+// Tangram platform shared by all the render slots of a process: it keeps the
+// fetched tiles on a disk cache shared by all the workers of the host, and
+// serves local tiles:
+//      file:///path/to/tiles/{z}/{x}/{y}.mvt
+//      mbtiles:///path/to/extract.mbtiles/{z}/{x}/{y}
+// The maps don't use it directly but through the SlotPlatform of their slot.
+class PaparazziPlatform : public LinuxPlatform {
+public:
+    explicit PaparazziPlatform(UrlClient::Options _urlClientOptions);
+    virtual ~PaparazziPlatform();
+
+    bool    startUrlRequest(const std::string &_url, Tangram::UrlCallback _callback) override;
+    void    cancelUrlRequest(const std::string &_url) override;
+
+    // Font files are read once and shared by all the maps of the process.
+    // POSTed scenes are served from memory.
+    std::string       stringFromFile(const char* _path) const override;
+    std::vector<char> bytesFromFile(const char* _path) const override;
+
+    // Keep the content of a POSTed scene (once per hash) and return the path to load it from
+    std::string addScene(const std::string &_hash, const std::string &_content);
+
+    // Responses are looked up here before going to the network
+    void    setTileCache(std::shared_ptr<DiskCache> _cache);
+
+protected:
+    // Go to the network (through curl), keeping a copy of the response on the tile cache
+    bool    fetch(const std::string &_url, Tangram::UrlCallback _callback);
+    // Serve requests from the tile cache and local files
+    void    read();
+    bool    readLocal(const std::string &_url, std::vector<char> &_data);
+
+    // Disk reads (tile cache and local tiles) happen on their own threads
+    struct CacheRequest {
+        std::string             url;
+        Tangram::UrlCallback    callback;
+    };
+    std::shared_ptr<DiskCache>      m_tile_cache;
+    std::deque<CacheRequest>        m_cache_requests;
+    std::mutex                      m_cache_mutex;
+    std::condition_variable         m_cache_condition;
+    std::vector<std::thread>        m_cache_threads;
+    bool                            m_cache_running;
+
+    // Opened by the first request that needs them, without holding the others
+    struct Archive {
+        std::once_flag              opened;
+        std::unique_ptr<MBTiles>    mbtiles;
+    };
+    std::map<std::string, std::shared_ptr<Archive>> m_archives;
+    std::mutex                      m_archives_mutex;
+
+    mutable std::map<std::string, std::vector<char>> m_fonts;
+    mutable std::mutex              m_fonts_mutex;
+
+    // POSTed scenes by content hash
+    bool    getScene(const std::string &_path, std::shared_ptr<const std::string> &_content) const;
+    mutable LruCache<std::shared_ptr<const std::string>> m_scenes;
+    mutable std::mutex              m_scenes_mutex;
+};
+
+// Tangram platform of a render slot, that let the render thread sleep until there is
+// new data for its maps (tiles or scenes) instead of spinning over Map::update().
+// Only the responses to its own requests and the render requests of its own maps
+// wake it up; everything else goes to the shared PaparazziPlatform.
+class SlotPlatform : public LinuxPlatform {
+public:
+    explicit SlotPlatform(std::shared_ptr<PaparazziPlatform> _shared);
+    virtual ~SlotPlatform();
+
+    void    requestRender() const override;
+    bool    startUrlRequest(const std::string &_url, Tangram::UrlCallback _callback) override;
+    void    cancelUrlRequest(const std::string &_url) override;
+
+    std::string       stringFromFile(const char* _path) const override;
+    std::vector<char> bytesFromFile(const char* _path) const override;
+
+    std::string addScene(const std::string &_hash, const std::string &_content) { return m_shared->addScene(_hash, _content); }
+
+    // Counter of events (url responses and render requests) received so far
+    unsigned long   getEvents() const;
+
+    // Block until the events counter moves past _events or _timeout (in seconds) expires.
+    // Returns false on timeout.
+    bool    waitForEvents(unsigned long _events, double _timeout) const;
+
+protected:
+    // Shared with the callbacks of the requests, which can outlive the slot
+    struct Events {
+        std::mutex              mutex;
+        std::condition_variable condition;
+        unsigned long           count = 0;
+
+        void    notify();
+    };
+
+    std::shared_ptr<PaparazziPlatform>  m_shared;
+    std::shared_ptr<Events>             m_events;
+};
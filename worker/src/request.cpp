@@ -0,0 +1,362 @@
+#include "request.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+// Query parameters, one bit each to know which ones were given
+enum Parameter {
+    PARAM_SCENE         = 1 << 0,
+    PARAM_WIDTH         = 1 << 1,
+    PARAM_HEIGHT        = 1 << 2,
+    PARAM_LAT           = 1 << 3,
+    PARAM_LON           = 1 << 4,
+    PARAM_ZOOM          = 1 << 5,
+    PARAM_DENSITY       = 1 << 6,
+    PARAM_TILT          = 1 << 7,
+    PARAM_ROTATION      = 1 << 8,
+    PARAM_TRANSPARENT   = 1 << 9,
+    PARAM_FORMAT        = 1 << 10,
+    PARAM_QUALITY       = 1 << 11,
+    PARAM_COMPRESSION   = 1 << 12,
+    PARAM_FILTER        = 1 << 13,
+    PARAM_AA            = 1 << 14
+};
+
+static const struct {
+    const char* name;
+    uint32_t    id;
+} PARAMETERS[] = {
+    {"scene", PARAM_SCENE}, {"width", PARAM_WIDTH}, {"height", PARAM_HEIGHT},
+    {"lat", PARAM_LAT}, {"lon", PARAM_LON}, {"zoom", PARAM_ZOOM},
+    {"density", PARAM_DENSITY}, {"tilt", PARAM_TILT}, {"rotation", PARAM_ROTATION},
+    {"transparent", PARAM_TRANSPARENT}, {"format", PARAM_FORMAT}, {"quality", PARAM_QUALITY},
+    {"compression", PARAM_COMPRESSION}, {"filter", PARAM_FILTER}, {"aa", PARAM_AA}
+};
+
+// Accepted values of the numeric parameters, also checked on the views of a batch
+static const struct {
+    uint32_t    id;
+    double      min;
+    double      max;
+    bool        integer;
+} RANGES[] = {
+    {PARAM_WIDTH, 1., MAX_IMAGE_SIZE, true}, {PARAM_HEIGHT, 1., MAX_IMAGE_SIZE, true},
+    {PARAM_LAT, -90., 90., false}, {PARAM_LON, -180., 180., false}, {PARAM_ZOOM, 0., 30., false},
+    {PARAM_DENSITY, 1., 8., false}, {PARAM_TILT, 0., 90., false}, {PARAM_ROTATION, -360., 360., false},
+    // jpg and webp: 1 is small, 100 is best (lossless for webp)
+    {PARAM_QUALITY, 1., 100., true},
+    // zlib level: 1 is fast, 9 is small
+    {PARAM_COMPRESSION, 0., 9., true}
+};
+
+// What makes a view, in the order they are asked for when missing
+static const uint32_t VIEW_PARAMETERS[] = {PARAM_WIDTH, PARAM_HEIGHT, PARAM_LAT, PARAM_LON, PARAM_ZOOM};
+
+static bool equals(const char* _data, size_t _size, const char* _str) {
+    return strlen(_str) == _size && memcmp(_data, _str, _size) == 0;
+}
+
+static int fromHex(char _c) {
+    if (_c >= '0' && _c <= '9') return _c - '0';
+    if (_c >= 'a' && _c <= 'f') return _c - 'a' + 10;
+    if (_c >= 'A' && _c <= 'F') return _c - 'A' + 10;
+    return -1;
+}
+
+// Percent decode _value into _out, returns false when it doesn't fit or is malformed
+static bool decode(const char* _value, size_t _size, char* _out, size_t _capacity, size_t &_out_size) {
+    _out_size = 0;
+    for (size_t i = 0; i < _size; i++) {
+        if (_out_size >= _capacity) {
+            return false;
+        }
+        char c = _value[i];
+        if (c == '%') {
+            if (i + 2 >= _size) {
+                return false;
+            }
+            int high = fromHex(_value[i + 1]);
+            int low = fromHex(_value[i + 2]);
+            if (high < 0 || low < 0) {
+                return false;
+            }
+            c = char(high * 16 + low);
+            i += 2;
+        } else if (c == '+') {
+            c = ' ';
+        }
+        _out[_out_size++] = c;
+    }
+    return true;
+}
+
+[[noreturn]] static void fail(const char* _format, const char* _name, double _min = 0., double _max = 0.) {
+    char message[256];
+    snprintf(message, sizeof(message), _format, _name, _min, _max);
+    throw std::invalid_argument(message);
+}
+
+// Short values (numbers and keywords) are decoded into a null terminated buffer on the stack
+#define VALUE_BUFFER 64
+static void decodeShort(const char* _name, const char* _value, size_t _size, char (&_buffer)[VALUE_BUFFER]) {
+    size_t size;
+    if (!decode(_value, _size, _buffer, VALUE_BUFFER - 1, size) || size == 0) {
+        fail("bad value for %s", _name);
+    }
+    _buffer[size] = '\0';
+}
+
+// Number (or integer) in the range of the parameter _id, throws when it's not
+static double checkRange(uint32_t _id, const char* _name, double _value, bool _parsed = true) {
+    for (const auto &range : RANGES) {
+        if (range.id != _id) {
+            continue;
+        }
+        if (range.integer) {
+            if (!_parsed || !std::isfinite(_value) || _value != std::floor(_value) || _value < range.min || _value > range.max) {
+                fail("%s must be an integer between %g and %g", _name, range.min, range.max);
+            }
+        } else if (!_parsed || !std::isfinite(_value) || _value < range.min || _value > range.max) {
+            fail("%s must be a number between %g and %g", _name, range.min, range.max);
+        }
+        return _value;
+    }
+    fail("%s is not a number", _name);
+}
+
+static double parseNumber(uint32_t _id, const char* _name, const char* _value, size_t _size) {
+    char buffer[VALUE_BUFFER];
+    decodeShort(_name, _value, _size, buffer);
+
+    char* end;
+    errno = 0;
+    double value = strtod(buffer, &end);
+    return checkRange(_id, _name, value, *end == '\0' && errno == 0);
+}
+
+static long parseInteger(uint32_t _id, const char* _name, const char* _value, size_t _size) {
+    char buffer[VALUE_BUFFER];
+    decodeShort(_name, _value, _size, buffer);
+
+    char* end;
+    errno = 0;
+    long value = strtol(buffer, &end, 10);
+    return checkRange(_id, _name, value, *end == '\0' && errno == 0);
+}
+
+// Unsigned decimal number, nothing else
+static bool parseDigits(const char* _begin, const char* _end, uint32_t &_value) {
+    if (_begin == _end || _end - _begin > 9) {
+        return false;
+    }
+    _value = 0;
+    for (const char* c = _begin; c < _end; c++) {
+        if (*c < '0' || *c > '9') {
+            return false;
+        }
+        _value = _value * 10 + (*c - '0');
+    }
+    return true;
+}
+
+void Request::parse(const char* _message, size_t _size) {
+    const char* end = _message + _size;
+
+    // Request line: METHOD SP target SP version
+    const char* target = static_cast<const char*>(memchr(_message, ' ', _size));
+    if (!target) {
+        throw std::invalid_argument("bad request line");
+    }
+    target++;
+    const char* target_end = static_cast<const char*>(memchr(target, ' ', end - target));
+    if (!target_end) {
+        throw std::invalid_argument("bad request line");
+    }
+
+    static const char separator[] = "\r\n\r\n";
+    const char* headers_end = std::search(target_end, end, separator, separator + 4);
+    if (headers_end != end) {
+        body.data = headers_end + 4;
+        body.size = end - body.data;
+    }
+
+    const char* query = static_cast<const char*>(memchr(target, '?', target_end - target));
+    const char* path_end = query ? query : target_end;
+    size_t path_size = path_end - target;
+
+    // Route
+    if (equals(target, path_size, "/check")) {
+        route = ROUTE_CHECK;
+        return;
+    } else if (equals(target, path_size, "/batch")) {
+        // The views are in the body
+        if (target - 1 - _message != 4 || memcmp(_message, "POST", 4) != 0) {
+            throw MethodNotAllowed("POST");
+        }
+        route = ROUTE_BATCH;
+    } else if (parseTile(target, path_size)) {
+        route = ROUTE_TILE;
+    }
+
+    // Query, the first value of every parameter wins
+    uint32_t seen = 0;
+    if (query) {
+        const char* param = query + 1;
+        while (param < target_end) {
+            const char* param_end = static_cast<const char*>(memchr(param, '&', target_end - param));
+            if (!param_end) {
+                param_end = target_end;
+            }
+            const char* eq = static_cast<const char*>(memchr(param, '=', param_end - param));
+            if (eq && eq + 1 < param_end) {
+                parseParameter(param, eq - param, eq + 1, param_end - (eq + 1), seen);
+            }
+            param = param_end + 1;
+        }
+    }
+
+    if (route == ROUTE_BATCH) {
+        return;
+    }
+
+    // A full view wins over the tile path
+    uint32_t missing = 0;
+    for (uint32_t id : VIEW_PARAMETERS) {
+        if (!(seen & id)) {
+            missing = missing ? missing : id;
+        }
+    }
+    if (!missing) {
+        route = ROUTE_VIEW;
+    } else if (route != ROUTE_TILE) {
+        for (const auto &parameter : PARAMETERS) {
+            if (parameter.id == missing) {
+                fail("%s is required (or a /{z}/{x}/{y}.png tile path)", parameter.name);
+            }
+        }
+    }
+}
+
+bool Request::parseTile(const char* _path, size_t _size) {
+    // .../{z}/{x}/{y}.{ext}
+    const char* end = _path + _size;
+    const char* dot = end;
+    while (dot > _path && *(dot - 1) != '.' && *(dot - 1) != '/') {
+        dot--;
+    }
+    if (dot == _path || *(dot - 1) != '.') {
+        return false;
+    }
+    uint32_t format;
+    if (!ImageEncoder::getFormat(dot, end - dot, format)) {
+        return false;
+    }
+    dot--;
+
+    uint32_t coords[3];
+    const char* segment_end = dot;
+    for (int i = 2; i >= 0; i--) {
+        const char* segment = segment_end;
+        while (segment > _path && *(segment - 1) != '/') {
+            segment--;
+        }
+        if (segment == _path || !parseDigits(segment, segment_end, coords[i])) {
+            return false;
+        }
+        segment_end = segment - 1;
+    }
+
+    if (coords[0] > 30 || coords[1] >= (1u << coords[0]) || coords[2] >= (1u << coords[0])) {
+        throw std::invalid_argument("tile out of range");
+    }
+
+    // The extension sets the format of the tile
+    options.format = format;
+    tile_z = coords[0];
+    tile_x = coords[1];
+    tile_y = coords[2];
+    return true;
+}
+
+void Request::parseParameter(const char* _name, size_t _name_size, const char* _value, size_t _value_size, uint32_t &_seen) {
+    uint32_t id = 0;
+    const char* name = nullptr;
+    for (const auto &parameter : PARAMETERS) {
+        if (equals(_name, _name_size, parameter.name)) {
+            id = parameter.id;
+            name = parameter.name;
+            break;
+        }
+    }
+    if (!id || (_seen & id)) {
+        return;
+    }
+    _seen |= id;
+
+    char buffer[VALUE_BUFFER];
+    switch (id) {
+        case PARAM_SCENE: {
+            size_t size;
+            if (!decode(_value, _value_size, m_scene, MAX_SCENE_URL, size)) {
+                fail("bad value for %s", name);
+            }
+            scene.data = m_scene;
+            scene.size = size;
+            break;
+        }
+        case PARAM_WIDTH:       width = parseInteger(id, name, _value, _value_size); break;
+        case PARAM_HEIGHT:      height = parseInteger(id, name, _value, _value_size); break;
+        case PARAM_LAT:         lat = parseNumber(id, name, _value, _value_size); break;
+        case PARAM_LON:         lon = parseNumber(id, name, _value, _value_size); break;
+        case PARAM_ZOOM:        zoom = parseNumber(id, name, _value, _value_size); break;
+        case PARAM_DENSITY:     density = parseNumber(id, name, _value, _value_size); break;
+        case PARAM_TILT:        tilt = parseNumber(id, name, _value, _value_size); break;
+        case PARAM_ROTATION:    rotation = parseNumber(id, name, _value, _value_size); break;
+        case PARAM_QUALITY:     options.quality = parseInteger(id, name, _value, _value_size); break;
+        case PARAM_COMPRESSION: options.compression = parseInteger(id, name, _value, _value_size); break;
+        case PARAM_TRANSPARENT:
+            // Keep the alpha of the scene background (opaque images are always encoded without alpha)
+            decodeShort(name, _value, _value_size, buffer);
+            if (!strcmp(buffer, "true") || !strcmp(buffer, "1"))           transparent = true;
+            else if (!strcmp(buffer, "false") || !strcmp(buffer, "0"))     transparent = false;
+            else fail("%s must be true or false", name);
+            break;
+        case PARAM_AA: {
+            decodeShort(name, _value, _value_size, buffer);
+            uint32_t mode;
+            if (!AntiAliasedBuffer::getMode(buffer, strlen(buffer), mode))
+                fail("%s must be none, ssaa or msaa", name);
+            aa = mode;
+            break;
+        }
+        case PARAM_FORMAT:
+            decodeShort(name, _value, _value_size, buffer);
+            if (!ImageEncoder::getFormat(buffer, strlen(buffer), options.format))
+                fail("%s must be png, png8, jpg or webp", name);
+            break;
+        case PARAM_FILTER:
+            decodeShort(name, _value, _value_size, buffer);
+            if (!strcmp(buffer, "none"))            options.filter = PNG_FILTER_NONE;
+            else if (!strcmp(buffer, "sub"))        options.filter = PNG_FILTER_SUB;
+            else if (!strcmp(buffer, "up"))         options.filter = PNG_FILTER_UP;
+            else if (!strcmp(buffer, "average"))    options.filter = PNG_FILTER_AVERAGE;
+            else if (!strcmp(buffer, "paeth"))      options.filter = PNG_FILTER_PAETH;
+            else if (!strcmp(buffer, "adaptive"))   options.filter = PNG_FILTER_ADAPTIVE;
+            else fail("%s must be none, sub, up, average, paeth or adaptive", name);
+            break;
+    }
+}
+
+double Request::checkViewValue(const char* _name, double _value) {
+    for (const auto &parameter : PARAMETERS) {
+        if (!strcmp(_name, parameter.name)) {
+            return checkRange(parameter.id, parameter.name, _value);
+        }
+    }
+    fail("%s is not a view parameter", _name);
+}
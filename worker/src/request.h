@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "tools/aab.h"
+#include "tools/image_encoder.h"
+
+#define MAX_SCENE_URL 4096
+#define MAX_IMAGE_SIZE 16384    // pixels per side
+
+// Bytes of someone else's buffer
+struct Slice {
+    const char* data = nullptr;
+    size_t      size = 0;
+
+    bool        empty() const { return size == 0; }
+    std::string str() const { return std::string(data, size); }
+};
+
+// Thrown by parse() when the route doesn't take the method of the request, fit for a 405
+class MethodNotAllowed : public std::invalid_argument {
+public:
+    MethodNotAllowed(const char* _allow) : std::invalid_argument(std::string("use ") + _allow), allow(_allow) {}
+
+    const char* allow;  // methods the route takes, for the Allow header
+};
+
+// Everything a paparazzi request says, filled in one pass over the raw http message
+// with no allocations. parse() throws std::invalid_argument with a message fit for a 400
+// (or MethodNotAllowed).
+//
+//      GET /check
+//      GET /?scene=URL&width=W&height=H&lat=LAT&lon=LON&zoom=Z[&options]
+//      GET /{z}/{x}/{y}.{png|png8|jpg|jpeg|webp}?scene=URL[&options]
+//      POST /batch?scene=URL[&options]   (JSON array of views)
+//
+// The scene can also be POSTed instead of given by url.
+class Request {
+public:
+    enum Route { ROUTE_CHECK, ROUTE_VIEW, ROUTE_TILE, ROUTE_BATCH };
+
+    Request() {}
+    Request(const Request&) = delete;
+    Request& operator=(const Request&) = delete;
+
+    void        parse(const char* _message, size_t _size);
+
+    // Same ranges as the query parameters for a value given some other way (the views of a batch),
+    // returns it or throws std::invalid_argument
+    static double checkViewValue(const char* _name, double _value);
+
+    Route       route = ROUTE_VIEW;
+    Slice       scene;          // url, percent decoded. Empty when the scene is POSTed
+    Slice       body;
+
+    // View (ROUTE_VIEW)
+    int         width = 0;
+    int         height = 0;
+    double      lat = 0.0;
+    double      lon = 0.0;
+    float       zoom = 0.0f;
+
+    // Tile (ROUTE_TILE)
+    uint32_t    tile_x = 0;
+    uint32_t    tile_y = 0;
+    uint32_t    tile_z = 0;
+
+    // Both
+    float       density = 1.0f;
+    float       tilt = 0.0f;        // degrees
+    float       rotation = 0.0f;    // degrees
+    int         aa = -1;            // AA_* antialiasing mode, -1 for the worker default
+
+    // Encoding
+    ImageOptions options;
+    bool        transparent = false;
+
+protected:
+    void        parseParameter(const char* _name, size_t _name_size, const char* _value, size_t _value_size, uint32_t &_seen);
+    bool        parseTile(const char* _path, size_t _size);
+
+    char        m_scene[MAX_SCENE_URL];
+};
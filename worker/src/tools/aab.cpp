@@ -2,18 +2,63 @@
 
 #define IMAGE_DEPTH 4
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
 // Tangram
 #include "log.h"
 
-// STB
-#include "stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
 
-AntiAliasedBuffer::AntiAliasedBuffer() : m_fbo_in(nullptr), m_fbo_out(nullptr), m_shader(nullptr), m_vbo(0), m_width(0), m_height(0), m_scale(2.) {
+// Major version of OpenGL or OpenGL ES
+static int getGLVersion() {
+    const char* version = (const char*)Tangram::GL::getString(GL_VERSION);
+    if (!version) {
+        return 0;
+    }
+
+    std::string str(version);
+    std::size_t es = str.find("OpenGL ES ");
+    if (es != std::string::npos) {
+        str = str.substr(es + 10);
+    }
+    return std::atoi(str.c_str());
+}
+
+// Pixel pack buffers are core since OpenGL 2.1 and OpenGL ES 3.0, but mapping them
+// needs glMapBufferRange (OpenGL 3.0 / ES 3.0)
+static bool supportsPbo() {
+#ifdef PLATFORM_RPI
+    return false;
+#else
+    return getGLVersion() >= 3;
+#endif
+}
 
-    // Create a simple vert/frag glsl shader to draw the main FBO with
-    std::string vertexShader = "#ifdef GL_ES\n\
+// Multisampled renderbuffers and glBlitFramebuffer are core since OpenGL 3.0 / ES 3.0
+static int getMaxSamples() {
+#ifdef PLATFORM_RPI
+    return 0;
+#else
+    if (getGLVersion() < 3) {
+        return 0;
+    }
+    GLint samples = 0;
+    Tangram::GL::getIntegerv(GL_MAX_SAMPLES, &samples);
+    return std::min<int>(samples, AA_MAX_SAMPLES);
+#endif
+}
+
+// Largest side of the textures and renderbuffers the buffers are made of
+static unsigned int getMaxTextureSize() {
+    GLint texture = 0, renderbuffer = 0;
+    Tangram::GL::getIntegerv(GL_MAX_TEXTURE_SIZE, &texture);
+    Tangram::GL::getIntegerv(GL_MAX_RENDERBUFFER_SIZE, &renderbuffer);
+    return std::max(0, std::min(texture, renderbuffer));
+}
+
+// Draws a full screen quad
+static const char* VERTEX_SHADER = "#ifdef GL_ES\n\
 precision mediump float;\n\
 #endif\n\
 attribute vec4 a_position;\n\
@@ -21,22 +66,76 @@ void main(void) {\n\
     gl_Position = a_position;\n\
 }";
 
-    std::string fragmentShader = "#ifdef GL_ES\n\
+// One separable pass of the downsampling along u_direction. Every output pixel weights the
+// input texels under the kernel, scaled to the footprint of the pixel, so any scale (2x, 1.5x...)
+// averages all of them. The kernel is chosen at compile time with a KERNEL_* define.
+// The picture only takes the u_source corner of a u_texture sized buffer, taps are kept inside.
+static const char* FRAGMENT_SHADER = "#ifdef GL_ES\n\
+#ifdef GL_FRAGMENT_PRECISION_HIGH\n\
+precision highp float;\n\
+#else\n\
 precision mediump float;\n\
 #endif\n\
+#endif\n\
+#define MAX_TAPS 17\n\
+#define PI 3.14159265\n\
 uniform sampler2D u_buffer;\n\
 uniform vec2 u_resolution;\n\
+uniform vec2 u_source;\n\
+uniform vec2 u_texture;\n\
+uniform vec2 u_direction;\n\
+uniform float u_scale;\n\
+uniform float u_flip;\n\
+uniform float u_opaque;\n\
+\n\
+// Weight of the texel at _d input texels from the center, for a filter _f texels wide\n\
+float weight(float _d, float _f) {\n\
+#if defined(KERNEL_BOX)\n\
+    return max(0., min(_d + .5, _f * .5) - max(_d - .5, -_f * .5));\n\
+#elif defined(KERNEL_LANCZOS2)\n\
+    float x = abs(_d / _f);\n\
+    if (x < 1e-4) return 1.;\n\
+    if (x >= 2.) return 0.;\n\
+    return 2. * sin(PI * x) * sin(PI * x * .5) / (PI * PI * x * x);\n\
+#else\n\
+    return max(0., 1. - abs(_d / _f));\n\
+#endif\n\
+}\n\
+\n\
 void main() {\n\
-    vec2 st = gl_FragCoord.xy/u_resolution.xy;\n\
-    st.y = 1.-st.y;\n\
-    gl_FragColor = vec4(0.,0.,0.,1.);\n\
-    gl_FragColor += texture2D(u_buffer, st);\n\
-    gl_FragColor.a = 1.;\n\
-    // gl_FragColor = vec4(st.x,st.y,0.,1.);\n\
+    vec2 st = gl_FragCoord.xy / u_resolution;\n\
+    st.y = mix(st.y, 1. - st.y, u_flip);\n\
+    vec2 across = vec2(1.) - u_direction;\n\
+    float center = dot(st * u_source, u_direction);\n\
+    vec2 other = st * u_source * across;\n\
+\n\
+    float f = max(u_scale, 1.);\n\
+#if defined(KERNEL_BOX)\n\
+    float radius = f * .5 + .5;\n\
+#elif defined(KERNEL_LANCZOS2)\n\
+    float radius = f * 2.;\n\
+#else\n\
+    float radius = f;\n\
+#endif\n\
+    float first = floor(center - radius) + .5;\n\
+\n\
+    vec4 color = vec4(0.);\n\
+    float total = 0.;\n\
+    for (int i = 0; i < MAX_TAPS; i++) {\n\
+        float t = first + float(i);\n\
+        if (t > center + radius) break;\n\
+        float w = weight(t - center, f);\n\
+        float inside = clamp(t, .5, dot(u_source, u_direction) - .5);\n\
+        color += texture2D(u_buffer, (u_direction * inside + other) / u_texture) * w;\n\
+        total += w;\n\
+    }\n\
+    gl_FragColor = color / total;\n\
+    gl_FragColor.a = max(gl_FragColor.a, u_opaque);\n\
 }";
 
-    m_shader = std::unique_ptr<Shader>(new Shader());
-    m_shader->load(fragmentShader, vertexShader);
+AntiAliasedBuffer::AntiAliasedBuffer() : m_pool(AAB_POOL_SIZE), m_shader(nullptr), m_vbo(0), m_pbo_head(0), m_pbo_pending(0), m_pbo_supported(false), m_width(0), m_height(0), m_mode(AA_SUPERSAMPLE), m_samples(0), m_max_size(0), m_kernel(AA_KERNEL_BOX), m_scale(2.), m_transparent(false) {
+
+    loadShader();
 
     GLfloat vertices[] = {  -1.0f, -1.0f, 0.0f,
                              1.0f, -1.0f, 0.0f,
@@ -48,6 +147,27 @@ void main() {\n\
     Tangram::GL::genBuffers(1, &m_vbo);
     Tangram::GL::bindBuffer(GL_ARRAY_BUFFER, m_vbo);
     Tangram::GL::bufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+    for (int i = 0; i < AAB_PBO_COUNT; i++) {
+        m_pbo[i] = 0;
+        m_pbo_size[i] = 0;
+        m_pbo_width[i] = 0;
+        m_pbo_height[i] = 0;
+    }
+
+    m_pbo_supported = supportsPbo();
+#ifndef PLATFORM_RPI
+    if (m_pbo_supported) {
+        glGenBuffers(AAB_PBO_COUNT, m_pbo);
+    }
+#endif
+    LOG("AntiAliasedBuffer: %s read back", m_pbo_supported ? "asynchronous PBO" : "synchronous");
+
+    m_samples = getMaxSamples();
+    LOG("AntiAliasedBuffer: %d samples MSAA", m_samples);
+
+    m_max_size = getMaxTextureSize();
+    LOG("AntiAliasedBuffer: %u pixels per side at most", m_max_size);
 }
 
 AntiAliasedBuffer::AntiAliasedBuffer(const unsigned int &_width, const unsigned int &_height) : AntiAliasedBuffer() {
@@ -55,63 +175,304 @@ AntiAliasedBuffer::AntiAliasedBuffer(const unsigned int &_width, const unsigned
 }
 
 AntiAliasedBuffer::~AntiAliasedBuffer() {
-
+#ifndef PLATFORM_RPI
+    if (m_pbo_supported) {
+        glDeleteBuffers(AAB_PBO_COUNT, m_pbo);
+    }
+#endif
+    Tangram::GL::deleteBuffers(1, &m_vbo);
 }
 
 void AntiAliasedBuffer::bind() {
-    m_fbo_in->bind();
+    if (m_mode == AA_MULTISAMPLE) {
+        m_buffers->msaa->bind();
+    } else {
+        m_buffers->in->bind();
+    }
+
+    // The picture takes the bottom left corner of the bucket
+    float scale = getRenderScale();
+    Tangram::GL::viewport(0, 0, m_width*scale, m_height*scale);
 }
 
 void AntiAliasedBuffer::unbind() {
-    m_fbo_in->unbind();
+    if (m_mode == AA_MULTISAMPLE) {
+        m_buffers->msaa->unbind();
+    } else {
+        m_buffers->in->unbind();
+    }
 }
 
 void AntiAliasedBuffer::setSize(const unsigned int &_width, const unsigned int &_height) {
     if (_width != m_width || _height != m_height) {
         m_width = _width;
         m_height = _height;
+        allocate();
+    }
+}
 
-        if (!m_fbo_in) {
-            m_fbo_in = std::unique_ptr<Fbo>(new Fbo(m_width*m_scale, m_height*m_scale));
-        } else {
-            m_fbo_in->resize(m_width*m_scale, m_height*m_scale);
+void AntiAliasedBuffer::setScale(const float &_scale){
+    float scale = std::max(1.0f, std::min((float)AA_MAX_SCALE, _scale));
+    if (scale != m_scale) {
+        m_scale = scale;
+        allocate();
+    }
+}
+
+void AntiAliasedBuffer::setKernel(uint32_t _kernel) {
+    if (_kernel != m_kernel) {
+        m_kernel = _kernel;
+        loadShader();
+    }
+}
+
+void AntiAliasedBuffer::loadShader() {
+    std::string defines;
+    switch (m_kernel) {
+        case AA_KERNEL_BILINEAR:    defines = "#define KERNEL_BILINEAR\n"; break;
+        case AA_KERNEL_LANCZOS2:    defines = "#define KERNEL_LANCZOS2\n"; break;
+        default:                    defines = "#define KERNEL_BOX\n"; break;
+    }
+
+    m_shader = std::unique_ptr<Shader>(new Shader());
+    m_shader->load(defines + FRAGMENT_SHADER, VERTEX_SHADER);
+}
+
+bool AntiAliasedBuffer::getKernel(const char *_name, size_t _size, uint32_t &_kernel) {
+    auto is = [_name, _size](const char *_str) { return strlen(_str) == _size && memcmp(_name, _str, _size) == 0; };
+    if (is("box")) {
+        _kernel = AA_KERNEL_BOX;
+    } else if (is("bilinear")) {
+        _kernel = AA_KERNEL_BILINEAR;
+    } else if (is("lanczos2")) {
+        _kernel = AA_KERNEL_LANCZOS2;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void AntiAliasedBuffer::setMode(uint32_t _mode) {
+    if (_mode == AA_MULTISAMPLE && m_samples == 0) {
+        _mode = AA_SUPERSAMPLE;
+    }
+    if (_mode != m_mode) {
+        m_mode = _mode;
+        allocate();
+    }
+}
+
+bool AntiAliasedBuffer::getMode(const char *_name, size_t _size, uint32_t &_mode) {
+    auto is = [_name, _size](const char *_str) { return strlen(_str) == _size && memcmp(_name, _str, _size) == 0; };
+    if (is("none")) {
+        _mode = AA_NONE;
+    } else if (is("ssaa")) {
+        _mode = AA_SUPERSAMPLE;
+    } else if (is("msaa")) {
+        _mode = AA_MULTISAMPLE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Sizes are rounded up to a step of an eighth of their power of two (at least 64 pixels),
+// so 256 stays 256, 600 goes to 640 and 1200 to 1280: never more than 1/8 wasted per side
+static unsigned int getBucket(unsigned int _size) {
+    unsigned int power = 1;
+    while (power < _size) {
+        power <<= 1;
+    }
+    unsigned int step = std::max(64u, power / 8);
+    return (_size + step - 1) / step * step;
+}
+
+unsigned int AntiAliasedBuffer::getMaxSize(uint32_t _mode) const {
+    // Multisampling falls back to supersampling where it's not supported
+    bool supersample = _mode == AA_SUPERSAMPLE || (_mode == AA_MULTISAMPLE && m_samples == 0);
+    float scale = supersample ? m_scale : 1.0f;
+
+    unsigned int size = m_max_size / scale;
+    while (size > 0 && getBucket(size) * scale > m_max_size) {
+        size--;
+    }
+    return size;
+}
+
+void AntiAliasedBuffer::allocate() {
+    if (m_width == 0 || m_height == 0) {
+        return;
+    }
+
+    float scale = getRenderScale();
+    unsigned int width = getBucket(m_width);
+    unsigned int height = getBucket(m_height);
+    char key[64];
+    snprintf(key, sizeof(key), "%u|%.3f|%ux%u", m_mode, scale, width, height);
+    if (m_buffers && m_buffers_key == key) {
+        return;
+    }
+
+    // Same bucket, mode and scale: no GPU allocation at all
+    std::shared_ptr<Buffers> buffers;
+    if (!m_pool.get(key, buffers)) {
+        buffers = std::make_shared<Buffers>();
+        size_t size = 0;
+
+        // Supersampling renders into the input at scale, the other modes at the output size
+        buffers->in = std::unique_ptr<Fbo>(new Fbo(width*scale, height*scale));
+        size += buffers->in->getWidth() * buffers->in->getHeight() * 8;
+
+        if (m_mode == AA_MULTISAMPLE) {
+            buffers->msaa = std::unique_ptr<Fbo>(new Fbo(width, height, true, m_samples));
+            size += width * height * 8 * m_samples;
         }
 
-        if (!m_fbo_out) {
-            m_fbo_out = std::unique_ptr<Fbo>(new Fbo(m_width, m_height, false));
-        } else {
-            m_fbo_out->resize(m_width, m_height, false);
+        // Output width by input height, between the horizontal and the vertical passes
+        if (scale != 1.0f) {
+            buffers->pass = std::unique_ptr<Fbo>(new Fbo(width, buffers->in->getHeight(), false));
+            size += width * buffers->in->getHeight() * 4;
         }
+
+        buffers->out = std::unique_ptr<Fbo>(new Fbo(width, height, false));
+        size += width * height * 4;
+
+        // Too big for the pool ones live only while they are used
+        m_pool.put(key, buffers, size);
     }
+    m_buffers = buffers;
+    m_buffers_key = key;
 }
 
-void AntiAliasedBuffer::setScale(const float &_scale){
-    if (_scale != m_scale) {
-        m_scale = _scale;
-    }
+void AntiAliasedBuffer::resolve() {
+#ifndef PLATFORM_RPI
+    // Same size on both sides, flipping and the alpha are left to the downsample pass
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_buffers->msaa->getGlHandle());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_buffers->in->getGlHandle());
+    glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+#endif
 }
 
-void write_func(void *context, void *data, int size) {
-    static_cast<std::string*>(context)->append(static_cast<const char*>(data), size);
+void AntiAliasedBuffer::setTransparent(bool _transparent) {
+    m_transparent = _transparent;
 }
 
-void AntiAliasedBuffer::getPixelsAsString(std::string &_image) {
-    m_fbo_out->bind();
-    
+// One pass of the kernel from the _width x _height corner of _source to the _target_width x _target_height one of the bound target
+void AntiAliasedBuffer::pass(const Fbo *_source, float _width, float _height, float _target_width, float _target_height, bool _vertical) {
+    Tangram::GL::viewport(0, 0, _target_width, _target_height);
+    m_shader->setUniform("u_resolution", _target_width, _target_height);
+    m_shader->setUniform("u_source", _width, _height);
+    m_shader->setUniform("u_texture", _source->getWidth(), _source->getHeight());
+    m_shader->setUniform("u_direction", _vertical ? 0.0f : 1.0f, _vertical ? 1.0f : 0.0f);
+    m_shader->setUniform("u_scale", _vertical ? _height / _target_height : _width / _target_width);
+    m_shader->setUniform("u_flip", _vertical ? 1.0f : 0.0f);
+    m_shader->setUniform("u_buffer", _source, 0);
+    Tangram::GL::drawArrays(GL_TRIANGLES, 0, 6);
+}
+
+void AntiAliasedBuffer::downsample() {
     // Load the vertex data
     Tangram::GL::bindBuffer(GL_ARRAY_BUFFER, m_vbo);
 
     m_shader->use();
-    m_shader->setUniform("u_resolution", m_width, m_height);
-    m_shader->setUniform("u_buffer", m_fbo_in.get(), 0);
+    m_shader->setUniform("u_opaque", m_transparent ? 0.0f : 1.0f);
     Tangram::GL::enableVertexAttribArray(0);
     Tangram::GL::vertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-    Tangram::GL::drawArrays(GL_TRIANGLES, 0, 6);
 
-    unsigned char *pixels = new unsigned char[m_width * m_height * IMAGE_DEPTH];   // allocate memory for the pixels
-    Tangram::GL::readPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels); // Read throug the current buffer pixels
-    stbi_write_png_to_func(&write_func, &_image, m_width, m_height, IMAGE_DEPTH, pixels, m_width * IMAGE_DEPTH);
-    delete [] pixels;
+    // Horizontal then vertical, at 1x the vertical pass alone is a plain (flipped) copy
+    float scale = getRenderScale();
+    unsigned int width = m_width*scale;
+    unsigned int height = m_height*scale;
+    const Fbo *source = m_buffers->in.get();
+    if (scale != 1.0f) {
+        m_buffers->pass->bind();
+        pass(source, width, height, m_width, height, false);
+        m_buffers->pass->unbind();
+        source = m_buffers->pass.get();
+        width = m_width;
+    }
+
+    m_buffers->out->bind();
+    pass(source, width, height, m_width, m_height, true);
+}
+
+bool AntiAliasedBuffer::requestPixels() {
+    if (m_pbo_pending == AAB_PBO_COUNT) {
+        LOGE("AntiAliasedBuffer: all the read back buffers are in use");
+        return false;
+    }
+
+    unsigned int index = (m_pbo_head + m_pbo_pending) % AAB_PBO_COUNT;
+    unsigned int size = m_width * m_height * IMAGE_DEPTH;
+    m_pbo_width[index] = m_width;
+    m_pbo_height[index] = m_height;
+
+    if (m_mode == AA_MULTISAMPLE) {
+        resolve();
+    }
+
+    downsample();
+
+#ifndef PLATFORM_RPI
+    if (m_pbo_supported) {
+        // The copy happens on the GPU/driver side, readPixels returns right away
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo[index]);
+        if (m_pbo_size[index] < size) {
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+            m_pbo_size[index] = size;
+        }
+        Tangram::GL::readPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    } else
+#endif
+    {
+        // Reuse the same memory from one request to the other
+        m_pixels[index].resize(size);
+        Tangram::GL::readPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, m_pixels[index].data());
+    }
+
+    m_buffers->out->unbind();
+    m_pbo_pending++;
+    return true;
+}
+
+const unsigned char* AntiAliasedBuffer::mapPixels(unsigned int &_width, unsigned int &_height) {
+    if (m_pbo_pending == 0) {
+        return nullptr;
+    }
+
+    _width = m_pbo_width[m_pbo_head];
+    _height = m_pbo_height[m_pbo_head];
+
+#ifndef PLATFORM_RPI
+    if (m_pbo_supported) {
+        // Blocks only if the copy is not done yet
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo[m_pbo_head]);
+        return (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, _width * _height * IMAGE_DEPTH, GL_MAP_READ_BIT);
+    }
+#endif
+    return m_pixels[m_pbo_head].data();
+}
+
+void AntiAliasedBuffer::unmapPixels() {
+    if (m_pbo_pending == 0) {
+        return;
+    }
+
+#ifndef PLATFORM_RPI
+    if (m_pbo_supported) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo[m_pbo_head]);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+#endif
+
+    m_pbo_head = (m_pbo_head + 1) % AAB_PBO_COUNT;
+    m_pbo_pending--;
+}
 
-    m_fbo_out->unbind();
+void AntiAliasedBuffer::discardPixels() {
+    m_pbo_head = 0;
+    m_pbo_pending = 0;
 }
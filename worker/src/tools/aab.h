@@ -2,11 +2,31 @@
 
 #include <string>
 #include <memory>
+#include <vector>
 
 #include "gl.h"
 
 #include "fbo.h"
 #include "shader.h"
+#include "lru_cache.h"
+
+// Number of pixel pack buffers used to read back asynchronously
+#define AAB_PBO_COUNT 2
+
+// GPU memory kept by the pool of buffers of the sizes not in use
+#define AAB_POOL_SIZE (128 * 1024 * 1024)
+
+// Antialiasing modes
+#define AA_NONE         0
+#define AA_SUPERSAMPLE  1   // render at scale times the size and downsample (default)
+#define AA_MULTISAMPLE  2   // render into multisampled renderbuffers and resolve them, supersamples where not supported
+#define AA_MAX_SAMPLES  4
+
+// Downsampling kernels, for any scale up to AA_MAX_SCALE
+#define AA_KERNEL_BOX       0   // average of the texels under every pixel (default)
+#define AA_KERNEL_BILINEAR  1   // tent, a bit softer
+#define AA_KERNEL_LANCZOS2  2   // sharper, can ring on hard edges
+#define AA_MAX_SCALE        4
 
 class AntiAliasedBuffer {
 public:
@@ -19,15 +39,69 @@ public:
 
     void    setSize(const unsigned int &_width, const unsigned int &_height);
     void    setScale(const float &_scale);
-    void    getPixelsAsString(std::string &_image);
+    void    setMode(uint32_t _mode);
+    void    setKernel(uint32_t _kernel);
+    void    setTransparent(bool _transparent);
+
+    uint32_t getMode() const { return m_mode; }
+    // Scale the map has to be rendered at for the current mode
+    float   getRenderScale() const { return m_mode == AA_SUPERSAMPLE ? m_scale : 1.0f; }
+    // Largest output side that fits the GL limits in _mode, once rounded up to its bucket and scaled
+    unsigned int getMaxSize(uint32_t _mode) const;
+
+    // Mode from its name (none, ssaa, msaa)
+    static bool getMode(const char *_name, size_t _size, uint32_t &_mode);
+    // Kernel from its name (box, bilinear, lanczos2)
+    static bool getKernel(const char *_name, size_t _size, uint32_t &_kernel);
+
+    // Asynchronous read back: requestPixels() downsamples the rendered buffer and starts
+    // copying it into a pixel pack buffer, mapPixels() waits and maps the oldest request
+    // and unmapPixels() releases it. Up to AAB_PBO_COUNT requests can be in flight, so
+    // the next picture can render while the previous one is still on its way.
+    bool    requestPixels();
+    const unsigned char* mapPixels(unsigned int &_width, unsigned int &_height);
+    void    unmapPixels();
+    // Forget the requests left in flight (by a job that failed half way)
+    void    discardPixels();
 
 protected:
-    std::unique_ptr<Fbo>    m_fbo_in;
-    std::unique_ptr<Fbo>    m_fbo_out;
+    void    allocate();
+    void    resolve();
+    void    loadShader();
+    void    downsample();
+    void    pass(const Fbo *_source, float _width, float _height, float _target_width, float _target_height, bool _vertical);
+
+    // The buffers of a size bucket. Pictures render into their bottom left corner, so
+    // every size that rounds up to the same bucket reuses them without reallocating.
+    struct Buffers {
+        std::unique_ptr<Fbo>    msaa;   // multisampled, resolved into in
+        std::unique_ptr<Fbo>    in;
+        std::unique_ptr<Fbo>    pass;   // horizontally downsampled
+        std::unique_ptr<Fbo>    out;
+    };
+    std::shared_ptr<Buffers>    m_buffers;
+    std::string                 m_buffers_key;
+    LruCache<std::shared_ptr<Buffers>> m_pool;  // by mode, scale and bucket
+
     std::unique_ptr<Shader> m_shader;
     GLuint                  m_vbo;
 
+    // Pixel pack buffers ring (or a plain CPU buffer when PBOs are not supported)
+    GLuint                  m_pbo[AAB_PBO_COUNT];
+    unsigned int            m_pbo_size[AAB_PBO_COUNT];
+    unsigned int            m_pbo_width[AAB_PBO_COUNT];
+    unsigned int            m_pbo_height[AAB_PBO_COUNT];
+    unsigned int            m_pbo_head;
+    unsigned int            m_pbo_pending;
+    bool                    m_pbo_supported;
+    std::vector<unsigned char> m_pixels[AAB_PBO_COUNT];
+
     unsigned int            m_width;
     unsigned int            m_height;
+    uint32_t                m_mode;
+    int                     m_samples;  // 0 when multisampling is not supported
+    unsigned int            m_max_size; // of textures and renderbuffers
+    uint32_t                m_kernel;
     float                   m_scale;
+    bool                    m_transparent;
 };
\ No newline at end of file
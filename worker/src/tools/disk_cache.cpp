@@ -0,0 +1,209 @@
+#include "disk_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+
+// Every entry starts with this tag followed by the size of the key and the key itself
+static const char DISK_CACHE_MAGIC[4] = { 'P', 'P', 'Z', '1' };
+
+DiskCache::DiskCache(const std::string &_path, size_t _max_size) : m_path(_path), m_max_size(_max_size), m_size(0), m_trim_requested(true), m_stop(false) {
+    if (!m_path.empty() && m_path.back() == '/') {
+        m_path.pop_back();
+    }
+    mkdir(m_path.c_str(), 0755);
+
+    // The first trim measures what previous runs left in the directory
+    m_trim_thread = std::thread(&DiskCache::trimLoop, this);
+}
+
+DiskCache::~DiskCache() {
+    {
+        std::lock_guard<std::mutex> lock(m_request_mutex);
+        m_stop = true;
+    }
+    m_request_condition.notify_one();
+    m_trim_thread.join();
+}
+
+void DiskCache::trimLoop() {
+    std::unique_lock<std::mutex> lock(m_request_mutex);
+    while (true) {
+        m_request_condition.wait(lock, [this] { return m_trim_requested || m_stop; });
+        if (m_stop) {
+            return;
+        }
+        m_trim_requested = false;
+
+        lock.unlock();
+        trim();
+        lock.lock();
+    }
+}
+
+std::string DiskCache::getFilename(const std::string &_key, std::string &_folder) const {
+    std::string hex = toHex(hash64(_key));
+    _folder = m_path + "/" + hex.substr(0, 2);
+    return _folder + "/" + hex;
+}
+
+bool DiskCache::get(const std::string &_key, std::string &_value) {
+    return read(_key, [&_value](const char *_data, size_t _size) { _value.assign(_data, _size); });
+}
+
+bool DiskCache::get(const std::string &_key, std::vector<char> &_value) {
+    return read(_key, [&_value](const char *_data, size_t _size) { _value.assign(_data, _data + _size); });
+}
+
+bool DiskCache::read(const std::string &_key, const std::function<void(const char*, size_t)> &_read) {
+    std::string folder;
+    std::string filename = getFilename(_key, folder);
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    size_t head = sizeof(DISK_CACHE_MAGIC) + sizeof(uint32_t) + _key.size();
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < head) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    const char *bytes = (const char*)data;
+    uint32_t key_size;
+    memcpy(&key_size, bytes + sizeof(DISK_CACHE_MAGIC), sizeof(uint32_t));
+
+    // Make sure this is the same key and not just the same hash
+    bool found = memcmp(bytes, DISK_CACHE_MAGIC, sizeof(DISK_CACHE_MAGIC)) == 0 &&
+                 key_size == _key.size() &&
+                 memcmp(bytes + sizeof(DISK_CACHE_MAGIC) + sizeof(uint32_t), _key.data(), _key.size()) == 0;
+    if (found) {
+        _read(bytes + head, st.st_size - head);
+    }
+    munmap(data, st.st_size);
+
+    if (found) {
+        // Recently used
+        utimensat(AT_FDCWD, filename.c_str(), NULL, 0);
+    }
+    return found;
+}
+
+bool DiskCache::put(const std::string &_key, const char *_data, size_t _size) {
+    std::string folder;
+    std::string filename = getFilename(_key, folder);
+    mkdir(folder.c_str(), 0755);
+
+    // Other workers may be reading it, write aside and swap it in
+    std::string tmp = filename + "." + std::to_string(getpid()) + "." +
+                      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    uint32_t key_size = _key.size();
+    bool ok = fwrite(DISK_CACHE_MAGIC, sizeof(DISK_CACHE_MAGIC), 1, file) == 1 &&
+              fwrite(&key_size, sizeof(uint32_t), 1, file) == 1 &&
+              fwrite(_key.data(), 1, _key.size(), file) == _key.size() &&
+              fwrite(_data, 1, _size, file) == _size;
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmp.c_str(), filename.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    // Over the size: the writer goes on, the background thread makes room
+    m_size += sizeof(DISK_CACHE_MAGIC) + sizeof(uint32_t) + _key.size() + _size;
+    if (m_size > m_max_size) {
+        {
+            std::lock_guard<std::mutex> lock(m_request_mutex);
+            m_trim_requested = true;
+        }
+        m_request_condition.notify_one();
+    }
+    return true;
+}
+
+void DiskCache::trim() {
+    std::lock_guard<std::mutex> lock(m_trim_mutex);
+    // What gets written during the scan is added back to the estimate at the end
+    size_t start = m_size;
+
+    struct File {
+        std::string path;
+        time_t      time;
+        size_t      size;
+    };
+    std::vector<File> files;
+    size_t total = 0;
+
+    DIR *root = opendir(m_path.c_str());
+    if (!root) {
+        return;
+    }
+
+    struct dirent *folder;
+    while ((folder = readdir(root)) != NULL) {
+        if (folder->d_name[0] == '.') {
+            continue;
+        }
+
+        std::string folder_path = m_path + "/" + folder->d_name;
+        DIR *dir = opendir(folder_path.c_str());
+        if (!dir) {
+            continue;
+        }
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+
+            std::string path = folder_path + "/" + entry->d_name;
+            struct stat st;
+            if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                files.push_back({ path, st.st_mtime, (size_t)st.st_size });
+                total += st.st_size;
+            }
+        }
+        closedir(dir);
+    }
+    closedir(root);
+
+    if (total > m_max_size) {
+        // Oldest first, leave some room so this doesn't happen on every write
+        std::sort(files.begin(), files.end(), [](const File &_a, const File &_b) { return _a.time < _b.time; });
+        size_t target = m_max_size - m_max_size / 10;
+        for (const File &file : files) {
+            if (total <= target) {
+                break;
+            }
+            if (unlink(file.path.c_str()) == 0) {
+                total -= file.size;
+            }
+        }
+    }
+    m_size += total - start;
+}
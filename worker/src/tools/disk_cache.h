@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Content addressed cache on a directory, safe to share between processes:
+// entries are written to a temporary file and renamed in place, reads are
+// memory mapped, and the least recently used files (by modification time,
+// refreshed on every hit) are removed once the directory grows over _max_size.
+// The size is a running estimate: the last scan of the directory plus what this
+// process wrote since, and the scans and removals run on a thread of their own.
+class DiskCache {
+public:
+    DiskCache(const std::string &_path, size_t _max_size);
+    virtual ~DiskCache();
+
+    bool    get(const std::string &_key, std::string &_value);
+    bool    get(const std::string &_key, std::vector<char> &_value);
+    bool    put(const std::string &_key, const char *_data, size_t _size);
+    bool    put(const std::string &_key, const std::string &_value) { return put(_key, _value.data(), _value.size()); }
+
+    const std::string& getPath() const { return m_path; }
+
+    // Remove the least recently used entries until the cache fits in its size,
+    // right away on the calling thread
+    void    trim();
+
+protected:
+    void    trimLoop();
+
+    // Map the entry of _key and hand its value to _read
+    bool    read(const std::string &_key, const std::function<void(const char*, size_t)> &_read);
+    std::string getFilename(const std::string &_key, std::string &_folder) const;
+
+    std::string         m_path;
+    size_t              m_max_size;
+    std::atomic<size_t> m_size;     // estimated size of the directory
+    std::mutex          m_trim_mutex;
+
+    // background trims, requested by put()
+    std::thread             m_trim_thread;
+    std::mutex              m_request_mutex;
+    std::condition_variable m_request_condition;
+    bool                    m_trim_requested;
+    bool                    m_stop;
+};
@@ -6,10 +6,13 @@
 #include "platform.h"
 #include "tangram.h"
 
-Fbo::Fbo():m_id(0), m_old_fbo_id(0), m_texture(0), m_depth_buffer(0), m_width(0), m_height(0), m_allocated(false), m_binded(false) {
+Fbo::Fbo():m_id(0), m_old_fbo_id(0), m_texture(0), m_color_buffer(0), m_depth_buffer(0), m_samples(0), m_width(0), m_height(0), m_allocated(false), m_binded(false) {
 }
 
-Fbo::Fbo(const unsigned int &_width, const unsigned int &_height, bool _depth):Fbo() {
+Fbo::Fbo(const unsigned int &_width, const unsigned int &_height, bool _depth, int _samples):Fbo() {
+#ifndef PLATFORM_RPI
+    m_samples = _samples;
+#endif
     resize(_width, _height, _depth);
 }
 
@@ -18,6 +21,7 @@ Fbo::~Fbo() {
 
     if (m_allocated) {
         Tangram::GL::deleteTextures(1, &m_texture);
+        glDeleteRenderbuffers(1, &m_color_buffer);
         glDeleteRenderbuffers(1, &m_depth_buffer);
         glDeleteFramebuffers(1, &m_id);
         m_allocated = false;
@@ -29,8 +33,12 @@ void Fbo::resize(const unsigned int &_width, const unsigned int &_height, bool _
         // Create a frame buffer
         glGenFramebuffers(1, &m_id);
 
-        // Generate a texture to hold the colour buffer
-        Tangram::GL::genTextures(1, &m_texture);
+        // Generate a texture (or a multisampled renderbuffer) to hold the colour buffer
+        if (m_samples > 0) {
+            glGenRenderbuffers(1, &m_color_buffer);
+        } else {
+            Tangram::GL::genTextures(1, &m_texture);
+        }
 
         // Depth Buffer
         if (_depth) {
@@ -45,6 +53,29 @@ void Fbo::resize(const unsigned int &_width, const unsigned int &_height, bool _
 
         bind();
 
+#ifndef PLATFORM_RPI
+        if (m_samples > 0) {
+            //  Multisampled color and depth, nothing samples them but the resolve
+            glBindRenderbuffer(GL_RENDERBUFFER, m_color_buffer);
+            glRenderbufferStorageMultisample(GL_RENDERBUFFER, m_samples, GL_RGBA8, m_width, m_height);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_color_buffer);
+
+            if (_depth) {
+                glBindRenderbuffer(GL_RENDERBUFFER, m_depth_buffer);
+                glRenderbufferStorageMultisample(GL_RENDERBUFFER, m_samples, GL_DEPTH_COMPONENT24, m_width, m_height);
+                glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth_buffer);
+            }
+
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE) {
+                m_allocated = true;
+            }
+
+            unbind();
+            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+            return;
+        }
+#endif
+
         //  Color Texture
         Tangram::GL::bindTexture(GL_TEXTURE_2D, m_texture);
         Tangram::GL::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
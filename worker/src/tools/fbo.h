@@ -5,7 +5,8 @@
 class Fbo {
 public:
     Fbo();
-    Fbo(const unsigned int &_width, const unsigned int &_height, bool _depth = true);
+    // With _samples the color goes to a multisampled renderbuffer (no texture) to be resolved with glBlitFramebuffer
+    Fbo(const unsigned int &_width, const unsigned int &_height, bool _depth = true, int _samples = 0);
     virtual ~Fbo();
 
     const unsigned int getWidth() const { return m_width; };
@@ -23,7 +24,9 @@ protected:
     GLuint  m_old_fbo_id;
 
     GLuint  m_texture;
+    GLuint  m_color_buffer;
     GLuint  m_depth_buffer;
+    int     m_samples;
 
     unsigned int m_width;
     unsigned int m_height;
@@ -0,0 +1,42 @@
+#include "image_encoder.h"
+
+#include "png_encoder.h"
+#include "jpeg_encoder.h"
+#include "webp_encoder.h"
+
+#include <cstring>
+
+std::unique_ptr<ImageEncoder> ImageEncoder::create(uint32_t _format) {
+    switch (_format) {
+        case IMAGE_FORMAT_PNG:
+            return std::unique_ptr<ImageEncoder>(new PngEncoder());
+        case IMAGE_FORMAT_PNG8:
+            return std::unique_ptr<ImageEncoder>(new Png8Encoder());
+        case IMAGE_FORMAT_JPEG:
+            return std::unique_ptr<ImageEncoder>(new JpegEncoder());
+        case IMAGE_FORMAT_WEBP:
+            return std::unique_ptr<ImageEncoder>(new WebpEncoder());
+        default:
+            return nullptr;
+    }
+}
+
+bool ImageEncoder::getFormat(const std::string &_name, uint32_t &_format) {
+    return getFormat(_name.data(), _name.size(), _format);
+}
+
+bool ImageEncoder::getFormat(const char *_name, size_t _size, uint32_t &_format) {
+    auto is = [_name, _size](const char *_str) { return strlen(_str) == _size && memcmp(_name, _str, _size) == 0; };
+    if (is("png")) {
+        _format = IMAGE_FORMAT_PNG;
+    } else if (is("png8")) {
+        _format = IMAGE_FORMAT_PNG8;
+    } else if (is("jpg") || is("jpeg")) {
+        _format = IMAGE_FORMAT_JPEG;
+    } else if (is("webp")) {
+        _format = IMAGE_FORMAT_WEBP;
+    } else {
+        return false;
+    }
+    return true;
+}
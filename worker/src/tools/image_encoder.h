@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Image formats
+#define IMAGE_FORMAT_PNG        0
+#define IMAGE_FORMAT_JPEG       1
+#define IMAGE_FORMAT_WEBP       2
+#define IMAGE_FORMAT_PNG8       3   // indexed PNG, up to 256 colors
+
+// PNG row filters (same values as the PNG filter types)
+#define PNG_FILTER_NONE         0
+#define PNG_FILTER_SUB          1
+#define PNG_FILTER_UP           2
+#define PNG_FILTER_AVERAGE      3
+#define PNG_FILTER_PAETH        4
+#define PNG_FILTER_ADAPTIVE     5   // try all of them on every row and keep the best one
+#define PNG_FILTER_AUTO         6   // fixed UP filter, ADAPTIVE for compression levels of 8 and up
+
+// How to encode a picture. Plain data, so it can travel next to the raw pixels.
+struct ImageOptions {
+    uint32_t    format      = IMAGE_FORMAT_PNG;
+    int32_t     compression = 6;    // zlib level, from 0 (store) to 9 (smallest)
+    uint32_t    filter      = PNG_FILTER_AUTO;
+    int32_t     quality     = 85;   // lossy formats, from 1 (worst) to 100 (best)
+};
+
+class ImageEncoder {
+public:
+    virtual ~ImageEncoder() {}
+
+    virtual const char* getMime() const = 0;
+
+    // Encode _height rows of _width pixels of _depth bytes each (top row first)
+    virtual bool encode(std::string &_out, const unsigned char *_pixels,
+                        unsigned int _width, unsigned int _height, unsigned int _depth,
+                        const ImageOptions &_options) = 0;
+
+    static std::unique_ptr<ImageEncoder> create(uint32_t _format);
+
+    // Format from its name or file extension (png, png8, jpg, jpeg, webp)
+    static bool getFormat(const std::string &_name, uint32_t &_format);
+    static bool getFormat(const char *_name, size_t _size, uint32_t &_format);
+};
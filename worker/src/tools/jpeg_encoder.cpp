@@ -0,0 +1,70 @@
+#include "jpeg_encoder.h"
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include "pixels.h"
+
+// libjpeg default error handler calls exit(), jump back to encode() instead.
+// The output buffer lives here too: it is set by libjpeg after setjmp() and
+// freed after the jump, where plain locals of encode() could be stale.
+struct jpeg_error_t {
+    struct jpeg_error_mgr   mgr;
+    jmp_buf                 jump;
+    unsigned char           *buffer = nullptr;
+    unsigned long           size = 0;
+};
+
+static void jpeg_error_exit(j_common_ptr _cinfo) {
+    jpeg_error_t *error = (jpeg_error_t*)_cinfo->err;
+    longjmp(error->jump, 1);
+}
+
+bool JpegEncoder::encode(std::string &_out, const unsigned char *_pixels,
+                         unsigned int _width, unsigned int _height, unsigned int _depth,
+                         const ImageOptions &_options) {
+    struct jpeg_compress_struct cinfo;
+    jpeg_error_t error;
+    std::vector<unsigned char> row(_width * 3);
+
+    cinfo.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jpeg_error_exit;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(error.buffer);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &error.buffer, &error.size);
+
+    cinfo.image_width = _width;
+    cinfo.image_height = _height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, _options.quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const unsigned char *src = _pixels + cinfo.next_scanline * _width * _depth;
+        if (_depth != 3) {
+            // Drop the alpha channel
+            rgbaToRgb(src, _width, row.data());
+            src = row.data();
+        }
+        JSAMPROW rows[1] = { (JSAMPROW)src };
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    _out.append((const char*)error.buffer, error.size);
+
+    jpeg_destroy_compress(&cinfo);
+    free(error.buffer);
+    return true;
+}
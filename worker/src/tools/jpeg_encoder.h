@@ -0,0 +1,13 @@
+#pragma once
+
+#include "image_encoder.h"
+
+// libjpeg(-turbo) backend, alpha is dropped
+class JpegEncoder : public ImageEncoder {
+public:
+    const char* getMime() const override { return "image/jpeg"; }
+
+    bool encode(std::string &_out, const unsigned char *_pixels,
+                unsigned int _width, unsigned int _height, unsigned int _depth,
+                const ImageOptions &_options) override;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Least recently used cache bounded by the total size (in bytes) of its values.
+// Not thread safe.
+template<typename T>
+class LruCache {
+public:
+    LruCache(size_t _max_size) : m_max_size(_max_size), m_size(0) {}
+
+    // Copy the value of _key into _value and mark it as the most recently used
+    bool get(const std::string &_key, T &_value) {
+        auto it = m_index.find(_key);
+        if (it == m_index.end()) {
+            return false;
+        }
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        _value = it->second->value;
+        return true;
+    }
+
+    bool has(const std::string &_key) const {
+        return m_index.find(_key) != m_index.end();
+    }
+
+    void put(const std::string &_key, const T &_value, size_t _size) {
+        if (_size > m_max_size) {
+            return;
+        }
+
+        erase(_key);
+        m_entries.push_front(Entry{_key, _value, _size});
+        m_index[_key] = m_entries.begin();
+        m_size += _size;
+
+        // Evict the least recently used until it fits
+        while (m_size > m_max_size && !m_entries.empty()) {
+            std::string oldest = m_entries.back().key;
+            erase(oldest);
+        }
+    }
+
+    void erase(const std::string &_key) {
+        auto it = m_index.find(_key);
+        if (it != m_index.end()) {
+            m_size -= it->second->size;
+            m_entries.erase(it->second);
+            m_index.erase(it);
+        }
+    }
+
+    // Visit every (key, value), the most recently used first
+    template<typename F>
+    void forEach(F _function) const {
+        for (const auto& entry : m_entries) {
+            _function(entry.key, entry.value);
+        }
+    }
+
+    size_t getSize() const { return m_size; }
+    size_t getCount() const { return m_entries.size(); }
+
+protected:
+    struct Entry {
+        std::string key;
+        T           value;
+        size_t      size;
+    };
+
+    std::list<Entry>    m_entries;  // most recently used first
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> m_index;
+
+    size_t  m_max_size;
+    size_t  m_size;
+};
@@ -0,0 +1,159 @@
+#include "mbtiles.h"
+
+#include <sqlite3.h>
+#include <zlib.h>
+
+#include "log.h"
+
+// Map up to 1GB of the archive
+#define MBTILES_MMAP_SIZE "1073741824"
+// Tiles per write transaction
+#define MBTILES_BATCH_SIZE 4096
+
+static bool inflateGzip(const unsigned char *_data, size_t _size, std::vector<char> &_out) {
+    z_stream stream = {};
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+        return false;
+    }
+
+    stream.next_in = (Bytef*)_data;
+    stream.avail_in = _size;
+
+    _out.clear();
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+        size_t offset = _out.size();
+        _out.resize(offset + _size * 4 + 1024);
+        stream.next_out = (Bytef*)&_out[offset];
+        stream.avail_out = _out.size() - offset;
+        ret = inflate(&stream, Z_NO_FLUSH);
+        _out.resize(_out.size() - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
+
+MBTiles::MBTiles(const std::string &_path) : m_db(nullptr), m_select(nullptr) {
+    if (sqlite3_open_v2(_path.c_str(), &m_db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK) {
+        LOGE("MBTiles: can't open %s", _path.c_str());
+        sqlite3_close(m_db);
+        m_db = nullptr;
+        return;
+    }
+
+    sqlite3_exec(m_db, "PRAGMA mmap_size=" MBTILES_MMAP_SIZE ";", NULL, NULL, NULL);
+
+    if (sqlite3_prepare_v2(m_db, "SELECT tile_data FROM tiles WHERE zoom_level=? AND tile_column=? AND tile_row=?;", -1, &m_select, NULL) != SQLITE_OK) {
+        LOGE("MBTiles: %s has no tiles table", _path.c_str());
+        sqlite3_close(m_db);
+        m_db = nullptr;
+        return;
+    }
+}
+
+MBTiles::~MBTiles() {
+    sqlite3_finalize(m_select);
+    sqlite3_close(m_db);
+}
+
+bool MBTiles::getTile(uint32_t _z, uint32_t _x, uint32_t _y, std::vector<char> &_data) {
+    if (!m_db || _z > 31) {
+        return false;
+    }
+
+    // MBTiles rows go from the bottom (TMS)
+    uint32_t row = ((1u << _z) - 1) - _y;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    sqlite3_reset(m_select);
+    sqlite3_bind_int(m_select, 1, _z);
+    sqlite3_bind_int(m_select, 2, _x);
+    sqlite3_bind_int(m_select, 3, row);
+
+    bool found = false;
+    if (sqlite3_step(m_select) == SQLITE_ROW) {
+        const unsigned char *blob = (const unsigned char*)sqlite3_column_blob(m_select, 0);
+        size_t size = sqlite3_column_bytes(m_select, 0);
+
+        if (size > 2 && blob[0] == 0x1f && blob[1] == 0x8b) {
+            found = inflateGzip(blob, size, _data);
+        } else {
+            _data.assign(blob, blob + size);
+            found = true;
+        }
+    }
+    sqlite3_reset(m_select);
+    return found;
+}
+
+MBTilesWriter::MBTilesWriter(const std::string &_path, const std::map<std::string, std::string> &_metadata) : m_db(nullptr), m_insert(nullptr), m_pending(0) {
+    if (sqlite3_open_v2(_path.c_str(), &m_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK) {
+        LOGE("MBTiles: can't create %s", _path.c_str());
+        sqlite3_close(m_db);
+        m_db = nullptr;
+        return;
+    }
+
+    // The archive is only readable once it's done, no need to pay for the journal
+    sqlite3_exec(m_db, "PRAGMA synchronous=OFF; PRAGMA journal_mode=MEMORY;", NULL, NULL, NULL);
+    sqlite3_exec(m_db, "CREATE TABLE IF NOT EXISTS metadata (name TEXT, value TEXT);"
+                       "CREATE UNIQUE INDEX IF NOT EXISTS metadata_name ON metadata (name);"
+                       "CREATE TABLE IF NOT EXISTS tiles (zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER, tile_data BLOB);"
+                       "CREATE UNIQUE INDEX IF NOT EXISTS tile_index ON tiles (zoom_level, tile_column, tile_row);", NULL, NULL, NULL);
+
+    sqlite3_stmt *metadata;
+    if (sqlite3_prepare_v2(m_db, "INSERT OR REPLACE INTO metadata (name, value) VALUES (?, ?);", -1, &metadata, NULL) == SQLITE_OK) {
+        for (const auto &entry : _metadata) {
+            sqlite3_bind_text(metadata, 1, entry.first.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(metadata, 2, entry.second.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_step(metadata);
+            sqlite3_reset(metadata);
+        }
+        sqlite3_finalize(metadata);
+    }
+
+    if (sqlite3_prepare_v2(m_db, "INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?);", -1, &m_insert, NULL) != SQLITE_OK) {
+        LOGE("MBTiles: can't write tiles to %s", _path.c_str());
+        sqlite3_close(m_db);
+        m_db = nullptr;
+    }
+}
+
+MBTilesWriter::~MBTilesWriter() {
+    flush();
+    sqlite3_finalize(m_insert);
+    sqlite3_close(m_db);
+}
+
+bool MBTilesWriter::putTile(uint32_t _z, uint32_t _x, uint32_t _y, const std::string &_data) {
+    if (!m_db || _z > 31) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pending == 0) {
+        sqlite3_exec(m_db, "BEGIN;", NULL, NULL, NULL);
+    }
+
+    // MBTiles rows go from the bottom (TMS)
+    sqlite3_bind_int(m_insert, 1, _z);
+    sqlite3_bind_int(m_insert, 2, _x);
+    sqlite3_bind_int(m_insert, 3, ((1u << _z) - 1) - _y);
+    sqlite3_bind_blob(m_insert, 4, _data.data(), _data.size(), SQLITE_STATIC);
+    bool done = sqlite3_step(m_insert) == SQLITE_DONE;
+    sqlite3_reset(m_insert);
+
+    if (++m_pending >= MBTILES_BATCH_SIZE) {
+        sqlite3_exec(m_db, "COMMIT;", NULL, NULL, NULL);
+        m_pending = 0;
+    }
+    return done;
+}
+
+void MBTilesWriter::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_db && m_pending > 0) {
+        sqlite3_exec(m_db, "COMMIT;", NULL, NULL, NULL);
+        m_pending = 0;
+    }
+}
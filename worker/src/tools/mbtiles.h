@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// Read only MBTiles archive. SQLite reads the file through a memory map, so a lookup
+// (missing tiles included) is a walk down the index of the tiles table in the page cache.
+class MBTiles {
+public:
+    MBTiles(const std::string &_path);
+    virtual ~MBTiles();
+
+    bool    isOpen() const { return m_db != nullptr; }
+
+    // Tile in XYZ (slippy map) coordinates, gzipped tiles are inflated
+    bool    getTile(uint32_t _z, uint32_t _x, uint32_t _y, std::vector<char> &_data);
+
+protected:
+    std::mutex                  m_mutex;
+    sqlite3                     *m_db;
+    sqlite3_stmt                *m_select;
+};
+
+// MBTiles archive being filled (for example by paparazzi_seed). Tiles are
+// inserted in transactions of a few thousands, safe to call from many threads.
+class MBTilesWriter {
+public:
+    MBTilesWriter(const std::string &_path, const std::map<std::string, std::string> &_metadata);
+    virtual ~MBTilesWriter();
+
+    bool    isOpen() const { return m_db != nullptr; }
+
+    // Tile in XYZ (slippy map) coordinates
+    bool    putTile(uint32_t _z, uint32_t _x, uint32_t _y, const std::string &_data);
+
+    // Commit the pending tiles
+    void    flush();
+
+protected:
+    std::mutex                  m_mutex;
+    sqlite3                     *m_db;
+    sqlite3_stmt                *m_insert;
+    size_t                      m_pending;
+};
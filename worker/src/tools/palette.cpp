@@ -0,0 +1,79 @@
+#include "palette.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Open addressing hash table, big enough to keep 256 colors sparse
+#define PALETTE_TABLE_SIZE 1024
+
+static inline uint32_t load_pixel(const unsigned char *_rgba) {
+    uint32_t pixel;
+    memcpy(&pixel, _rgba, 4);
+    return pixel;
+}
+
+bool getExactPalette(const unsigned char *_rgba, unsigned int _count,
+                     std::vector<uint32_t> &_palette, std::vector<unsigned char> &_indices,
+                     unsigned int _max_colors) {
+    uint32_t keys[PALETTE_TABLE_SIZE];
+    int16_t values[PALETTE_TABLE_SIZE];
+    memset(values, -1, sizeof(values));
+
+    if (_max_colors > 256) {
+        _max_colors = 256;
+    }
+
+    _palette.clear();
+    _indices.resize(_count);
+    if (_count == 0) {
+        return true;
+    }
+
+    unsigned char *indices = _indices.data();
+    uint32_t last = ~load_pixel(_rgba);
+    unsigned char last_index = 0;
+
+    unsigned int i = 0;
+    while (i < _count) {
+#ifdef __SSE2__
+        // Maps are mostly flat areas: skip runs of the last color four pixels at a time
+        __m128i last4 = _mm_set1_epi32(last);
+        while (i + 4 <= _count) {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(_rgba + i * 4));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(pixels, last4)) != 0xFFFF) {
+                break;
+            }
+            memset(indices + i, last_index, 4);
+            i += 4;
+        }
+        if (i >= _count) {
+            break;
+        }
+#endif
+        uint32_t color = load_pixel(_rgba + i * 4);
+        if (color != last) {
+            unsigned int slot = (color * 2654435761u) >> 22;    // 10 bits, PALETTE_TABLE_SIZE
+            while (values[slot] != -1 && keys[slot] != color) {
+                slot = (slot + 1) & (PALETTE_TABLE_SIZE - 1);
+            }
+
+            if (values[slot] == -1) {
+                if (_palette.size() == _max_colors) {
+                    return false;
+                }
+                keys[slot] = color;
+                values[slot] = _palette.size();
+                _palette.push_back(color);
+            }
+
+            last = color;
+            last_index = values[slot];
+        }
+        indices[i++] = last_index;
+    }
+
+    return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Look for the exact palette of an RGBA image. On success _palette holds the colors
+// (packed as they are in memory) and _indices the palette index of every pixel.
+// Returns false as soon as the image has more than _max_colors (up to 256) colors.
+bool getExactPalette(const unsigned char *_rgba, unsigned int _count,
+                     std::vector<uint32_t> &_palette, std::vector<unsigned char> &_indices,
+                     unsigned int _max_colors = 256);
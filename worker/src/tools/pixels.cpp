@@ -0,0 +1,70 @@
+#include "pixels.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#define PIXELS_X86
+#endif
+
+bool isOpaque(const unsigned char *_rgba, unsigned int _count) {
+    unsigned int i = 0;
+
+#ifdef PIXELS_X86
+    // AND sixteen pixels at a time, every alpha byte must stay at 255
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    while (i + 16 <= _count) {
+        const __m128i *src = (const __m128i*)(_rgba + i * 4);
+        __m128i all = _mm_and_si128(_mm_and_si128(_mm_loadu_si128(src), _mm_loadu_si128(src + 1)),
+                                    _mm_and_si128(_mm_loadu_si128(src + 2), _mm_loadu_si128(src + 3)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(all, alpha), alpha)) != 0xFFFF) {
+            return false;
+        }
+        i += 16;
+    }
+#endif
+
+    for (; i < _count; i++) {
+        if (_rgba[i * 4 + 3] != 255) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void rgbaToRgbScalar(const unsigned char *_rgba, unsigned int _count, unsigned char *_rgb) {
+    for (unsigned int i = 0; i < _count; i++) {
+        _rgb[i * 3] = _rgba[i * 4];
+        _rgb[i * 3 + 1] = _rgba[i * 4 + 1];
+        _rgb[i * 3 + 2] = _rgba[i * 4 + 2];
+    }
+}
+
+#ifdef PIXELS_X86
+// Shuffle four RGBA pixels into twelve RGB bytes at a time
+__attribute__((target("ssse3")))
+static void rgbaToRgbSsse3(const unsigned char *_rgba, unsigned int _count, unsigned char *_rgb) {
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    unsigned int i = 0;
+    // Each store writes 16 bytes, keep the last 4 pixels for the scalar tail so it never writes past _rgb
+    while (i + 8 <= _count) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(_rgba + i * 4));
+        _mm_storeu_si128((__m128i*)(_rgb + i * 3), _mm_shuffle_epi8(pixels, shuffle));
+        i += 4;
+    }
+    rgbaToRgbScalar(_rgba + i * 4, _count - i, _rgb + i * 3);
+}
+#endif
+
+void rgbaToRgb(const unsigned char *_rgba, unsigned int _count, unsigned char *_rgb) {
+#ifdef PIXELS_X86
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+    if (ssse3) {
+        rgbaToRgbSsse3(_rgba, _count, _rgb);
+        return;
+    }
+#endif
+    rgbaToRgbScalar(_rgba, _count, _rgb);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// True when all the _count RGBA pixels have an alpha of 255
+bool    isOpaque(const unsigned char *_rgba, unsigned int _count);
+
+// Drop the alpha channel of _count RGBA pixels into _rgb (3 bytes per pixel)
+void    rgbaToRgb(const unsigned char *_rgba, unsigned int _count, unsigned char *_rgb);
@@ -0,0 +1,302 @@
+#include "png_encoder.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "palette.h"
+#include "pixels.h"
+
+#define PNG_IDAT_SIZE 65536
+
+static const unsigned char PNG_SIGNATURE[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+static void put_uint32(unsigned char *_dst, uint32_t _value) {
+    _dst[0] = (_value >> 24) & 0xff;
+    _dst[1] = (_value >> 16) & 0xff;
+    _dst[2] = (_value >> 8) & 0xff;
+    _dst[3] = _value & 0xff;
+}
+
+static inline unsigned char paeth(int _a, int _b, int _c) {
+    int p = _a + _b - _c;
+    int pa = abs(p - _a);
+    int pb = abs(p - _b);
+    int pc = abs(p - _c);
+    if (pa <= pb && pa <= pc) return _a;
+    if (pb <= pc) return _b;
+    return _c;
+}
+
+PngWriter::PngWriter(std::string &_out, unsigned int _width, unsigned int _height, unsigned int _depth, int _compression, unsigned int _filter) :
+    m_out(_out), m_width(_width), m_height(_height), m_depth(_depth), m_rows(0), m_filter(_filter),
+    m_header(false), m_finished(false), m_error(false) {
+
+    if (m_filter == PNG_FILTER_AUTO) {
+        if (m_depth == 1) {
+            // Filters rarely help indexed images
+            m_filter = PNG_FILTER_NONE;
+        } else {
+            m_filter = (_compression >= 8) ? PNG_FILTER_ADAPTIVE : PNG_FILTER_UP;
+        }
+    }
+
+    size_t stride = m_width * m_depth;
+    m_prev_row.assign(stride, 0);
+    m_filtered.resize(stride + 1);
+    if (m_filter == PNG_FILTER_ADAPTIVE) {
+        m_candidate.resize(stride + 1);
+    }
+    m_idat.resize(PNG_IDAT_SIZE);
+
+    memset(&m_zstream, 0, sizeof(m_zstream));
+    int strategy = (m_filter == PNG_FILTER_NONE) ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+    if (deflateInit2(&m_zstream, _compression, Z_DEFLATED, 15, 8, strategy) != Z_OK) {
+        m_error = true;
+    }
+    m_zstream.next_out = m_idat.data();
+    m_zstream.avail_out = m_idat.size();
+}
+
+PngWriter::~PngWriter() {
+    deflateEnd(&m_zstream);
+}
+
+void PngWriter::writeChunk(const char *_type, const unsigned char *_data, unsigned int _size) {
+    unsigned char head[8];
+    put_uint32(head, _size);
+    memcpy(head + 4, _type, 4);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, head + 4, 4);
+    if (_size > 0) {
+        crc = crc32(crc, _data, _size);
+    }
+
+    unsigned char tail[4];
+    put_uint32(tail, crc);
+
+    m_out.append((const char*)head, 8);
+    if (_size > 0) {
+        m_out.append((const char*)_data, _size);
+    }
+    m_out.append((const char*)tail, 4);
+}
+
+void PngWriter::writeHeader() {
+    unsigned char ihdr[13];
+    put_uint32(ihdr, m_width);
+    put_uint32(ihdr + 4, m_height);
+    ihdr[8] = 8;                            // bit depth
+    ihdr[9] = (m_depth == 4) ? 6 : (m_depth == 3) ? 2 : 3; // color type: RGBA, RGB or indexed
+    ihdr[10] = 0;                           // deflate
+    ihdr[11] = 0;                           // adaptive filtering
+    ihdr[12] = 0;                           // no interlace
+
+    m_out.append((const char*)PNG_SIGNATURE, 8);
+    writeChunk("IHDR", ihdr, 13);
+
+    if (m_depth == 1) {
+        // Colors, and their alpha up to the last one that is not opaque
+        std::vector<unsigned char> plte(m_palette.size() * 3);
+        std::vector<unsigned char> trns(m_palette.size());
+        unsigned int trns_size = 0;
+        for (unsigned int i = 0; i < m_palette.size(); i++) {
+            const unsigned char *color = (const unsigned char*)&m_palette[i];
+            plte[i * 3] = color[0];
+            plte[i * 3 + 1] = color[1];
+            plte[i * 3 + 2] = color[2];
+            trns[i] = color[3];
+            if (color[3] != 255) {
+                trns_size = i + 1;
+            }
+        }
+        writeChunk("PLTE", plte.data(), plte.size());
+        if (trns_size > 0) {
+            writeChunk("tRNS", trns.data(), trns_size);
+        }
+    }
+
+    m_header = true;
+}
+
+void PngWriter::setPalette(const std::vector<uint32_t> &_palette) {
+    m_palette = _palette;
+}
+
+void PngWriter::filterRow(unsigned char _type, const unsigned char *_row, unsigned char *_out) const {
+    const unsigned char *prev = m_prev_row.data();
+    unsigned int stride = m_width * m_depth;
+    unsigned int bpp = m_depth;
+
+    _out[0] = _type;
+    _out++;
+
+    switch (_type) {
+        case PNG_FILTER_NONE:
+            memcpy(_out, _row, stride);
+            break;
+        case PNG_FILTER_SUB:
+            memcpy(_out, _row, bpp);
+            for (unsigned int i = bpp; i < stride; i++) {
+                _out[i] = _row[i] - _row[i - bpp];
+            }
+            break;
+        case PNG_FILTER_UP:
+            for (unsigned int i = 0; i < stride; i++) {
+                _out[i] = _row[i] - prev[i];
+            }
+            break;
+        case PNG_FILTER_AVERAGE:
+            for (unsigned int i = 0; i < bpp; i++) {
+                _out[i] = _row[i] - (prev[i] >> 1);
+            }
+            for (unsigned int i = bpp; i < stride; i++) {
+                _out[i] = _row[i] - ((_row[i - bpp] + prev[i]) >> 1);
+            }
+            break;
+        case PNG_FILTER_PAETH:
+            for (unsigned int i = 0; i < bpp; i++) {
+                _out[i] = _row[i] - prev[i];
+            }
+            for (unsigned int i = bpp; i < stride; i++) {
+                _out[i] = _row[i] - paeth(_row[i - bpp], prev[i], prev[i - bpp]);
+            }
+            break;
+    }
+}
+
+// Same heuristic as libpng: keep the filter with the smallest sum of absolute (signed) values
+unsigned char PngWriter::chooseFilter(const unsigned char *_row) {
+    unsigned int stride = m_width * m_depth;
+    unsigned long best_sum = (unsigned long)-1;
+    unsigned char best = PNG_FILTER_NONE;
+
+    for (unsigned char type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; type++) {
+        filterRow(type, _row, m_candidate.data());
+
+        unsigned long sum = 0;
+        for (unsigned int i = 1; i <= stride && sum < best_sum; i++) {
+            sum += abs((signed char)m_candidate[i]);
+        }
+
+        if (sum < best_sum) {
+            best_sum = sum;
+            best = type;
+            m_filtered.swap(m_candidate);
+        }
+    }
+    return best;
+}
+
+bool PngWriter::deflateRow(int _flush) {
+    int ret = Z_OK;
+    do {
+        ret = deflate(&m_zstream, _flush);
+        if (ret == Z_STREAM_ERROR) {
+            m_error = true;
+            return false;
+        }
+
+        // IDAT buffer is full, send it out
+        if (m_zstream.avail_out == 0) {
+            writeChunk("IDAT", m_idat.data(), m_idat.size());
+            m_zstream.next_out = m_idat.data();
+            m_zstream.avail_out = m_idat.size();
+        }
+    } while (m_zstream.avail_in > 0 || (_flush == Z_FINISH && ret != Z_STREAM_END));
+
+    return true;
+}
+
+bool PngWriter::writeRow(const unsigned char *_row) {
+    if (m_error || m_finished || m_rows >= m_height || (m_depth == 1 && m_palette.empty())) {
+        return false;
+    }
+
+    if (!m_header) {
+        writeHeader();
+    }
+
+    if (m_filter == PNG_FILTER_ADAPTIVE) {
+        chooseFilter(_row);
+    } else {
+        filterRow(m_filter, _row, m_filtered.data());
+    }
+
+    m_zstream.next_in = m_filtered.data();
+    m_zstream.avail_in = m_filtered.size();
+    if (!deflateRow(Z_NO_FLUSH)) {
+        return false;
+    }
+
+    memcpy(m_prev_row.data(), _row, m_prev_row.size());
+    m_rows++;
+    return true;
+}
+
+bool PngWriter::writeRows(const unsigned char *_rows, unsigned int _count, unsigned int _stride) {
+    for (unsigned int i = 0; i < _count; i++) {
+        if (!writeRow(_rows + i * _stride)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PngWriter::finish() {
+    if (m_error || m_finished || m_rows != m_height) {
+        return false;
+    }
+
+    m_zstream.next_in = Z_NULL;
+    m_zstream.avail_in = 0;
+    if (!deflateRow(Z_FINISH)) {
+        return false;
+    }
+
+    // What is left on the IDAT buffer
+    unsigned int size = m_idat.size() - m_zstream.avail_out;
+    if (size > 0) {
+        writeChunk("IDAT", m_idat.data(), size);
+    }
+    writeChunk("IEND", nullptr, 0);
+
+    m_finished = true;
+    return true;
+}
+
+bool PngEncoder::encode(std::string &_out, const unsigned char *_pixels,
+                        unsigned int _width, unsigned int _height, unsigned int _depth,
+                        const ImageOptions &_options) {
+    if (_depth == 4 && isOpaque(_pixels, _width * _height)) {
+        // The alpha channel carries nothing, write RGB rows and save a quarter of the bytes to deflate
+        std::vector<unsigned char> row(_width * 3);
+        PngWriter writer(_out, _width, _height, 3, _options.compression, _options.filter);
+        for (unsigned int y = 0; y < _height; y++) {
+            rgbaToRgb(_pixels + y * _width * 4, _width, row.data());
+            if (!writer.writeRow(row.data())) {
+                return false;
+            }
+        }
+        return writer.finish();
+    }
+
+    PngWriter writer(_out, _width, _height, _depth, _options.compression, _options.filter);
+    return writer.writeRows(_pixels, _height, _width * _depth) && writer.finish();
+}
+
+bool Png8Encoder::encode(std::string &_out, const unsigned char *_pixels,
+                         unsigned int _width, unsigned int _height, unsigned int _depth,
+                         const ImageOptions &_options) {
+    std::vector<uint32_t> palette;
+    std::vector<unsigned char> indices;
+
+    if (_depth != 4 || !getExactPalette(_pixels, _width * _height, palette, indices)) {
+        // Too many colors, RGB(A) it is
+        return PngEncoder::encode(_out, _pixels, _width, _height, _depth, _options);
+    }
+
+    PngWriter writer(_out, _width, _height, 1, _options.compression, _options.filter);
+    writer.setPalette(palette);
+    return writer.writeRows(indices.data(), _height, _width) && writer.finish();
+}
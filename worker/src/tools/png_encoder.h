@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "image_encoder.h"
+
+// Streaming PNG writer: rows are filtered and deflated as they come,
+// so the whole image never needs to be in memory at once
+class PngWriter {
+public:
+    // _depth is the number of bytes per pixel: 1 (palette index), 3 (RGB) or 4 (RGBA)
+    PngWriter(std::string &_out, unsigned int _width, unsigned int _height, unsigned int _depth, int _compression, unsigned int _filter);
+    virtual ~PngWriter();
+
+    // Colors of an indexed image (packed RGBA), set it before writing any row
+    void    setPalette(const std::vector<uint32_t> &_palette);
+
+    bool    writeRow(const unsigned char *_row);
+    bool    writeRows(const unsigned char *_rows, unsigned int _count, unsigned int _stride);
+    bool    finish();
+
+protected:
+    void    writeHeader();
+    void    writeChunk(const char *_type, const unsigned char *_data, unsigned int _size);
+    bool    deflateRow(int _flush);
+    void    filterRow(unsigned char _type, const unsigned char *_row, unsigned char *_out) const;
+    unsigned char chooseFilter(const unsigned char *_row);
+
+    std::string                 &m_out;
+    z_stream                    m_zstream;
+    std::vector<unsigned char>  m_prev_row;
+    std::vector<unsigned char>  m_filtered;     // filter type byte + filtered row
+    std::vector<unsigned char>  m_candidate;
+    std::vector<unsigned char>  m_idat;
+    std::vector<uint32_t>       m_palette;
+
+    unsigned int    m_width;
+    unsigned int    m_height;
+    unsigned int    m_depth;
+    unsigned int    m_rows;
+    unsigned int    m_filter;
+    bool            m_header;
+    bool            m_finished;
+    bool            m_error;
+};
+
+class PngEncoder : public ImageEncoder {
+public:
+    const char* getMime() const override { return "image/png"; }
+
+    bool encode(std::string &_out, const unsigned char *_pixels,
+                unsigned int _width, unsigned int _height, unsigned int _depth,
+                const ImageOptions &_options) override;
+};
+
+// 8 bits indexed PNG when the image has up to 256 colors, regular PNG otherwise
+class Png8Encoder : public PngEncoder {
+public:
+    bool encode(std::string &_out, const unsigned char *_pixels,
+                unsigned int _width, unsigned int _height, unsigned int _depth,
+                const ImageOptions &_options) override;
+};
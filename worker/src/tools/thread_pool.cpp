@@ -0,0 +1,93 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned int _threads) : m_stop(false) {
+    for (unsigned int i = 0; i < _threads; i++) {
+        m_threads.emplace_back(&ThreadPool::run, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    for (auto &thread : m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            if (m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t _count, const std::function<void(uint32_t)> &_function) {
+    // Helpers that start late find nothing left and only touch the shared state,
+    // _function is never called once the last index is done
+    struct Job {
+        std::atomic<uint32_t>   next{0};
+        uint32_t                done = 0;
+        std::mutex              mutex;
+        std::condition_variable condition;
+    };
+    auto job = std::make_shared<Job>();
+    const std::function<void(uint32_t)> *function = &_function;
+    auto work = [job, function, _count]() {
+        uint32_t count = 0;
+        for (uint32_t i = job->next++; i < _count; i = job->next++) {
+            (*function)(i);
+            count++;
+        }
+        if (count > 0) {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->done += count;
+            if (job->done == _count) {
+                job->condition.notify_all();
+            }
+        }
+    };
+
+    uint32_t helpers = std::min<uint32_t>(_count > 0 ? _count - 1 : 0, m_threads.size());
+    if (helpers > 0) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (uint32_t i = 0; i < helpers; i++) {
+                m_tasks.push_back(work);
+            }
+        }
+        m_condition.notify_all();
+    }
+
+    work();
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->condition.wait(lock, [&]() { return job->done == _count; });
+}
+
+void ThreadPool::post(std::function<void()> _task) {
+    if (m_threads.empty()) {
+        _task();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(_task));
+    }
+    m_condition.notify_one();
+}
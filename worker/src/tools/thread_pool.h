@@ -0,0 +1,37 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads created once at startup and shared by everybody that wants to
+// split its work, so the number of threads stays bound whatever the number of jobs.
+class ThreadPool {
+public:
+    ThreadPool(unsigned int _threads);
+    virtual ~ThreadPool();
+
+    // Run _function for 0.._count-1 on the pool, the calling thread included, and return
+    // once all of them are done. The caller takes its share, so it never waits on a pool
+    // busy with other jobs (or with the job that called it). _function must not throw.
+    void    parallelFor(uint32_t _count, const std::function<void(uint32_t)> &_function);
+
+    // Queue _task and return right away, or run it here when the pool has no threads.
+    // Waiting for it is up to the caller. _task must not throw.
+    void    post(std::function<void()> _task);
+
+    unsigned int getThreads() const { return m_threads.size(); }
+
+protected:
+    void    run();
+
+    std::vector<std::thread>            m_threads;
+    std::deque<std::function<void()>>   m_tasks;
+    std::mutex                          m_mutex;
+    std::condition_variable             m_condition;
+    bool                                m_stop;
+};
@@ -0,0 +1,47 @@
+#include "webp_encoder.h"
+
+#include <cstdlib>
+#include <vector>
+
+#include <webp/encode.h>
+
+#include "pixels.h"
+
+bool WebpEncoder::encode(std::string &_out, const unsigned char *_pixels,
+                         unsigned int _width, unsigned int _height, unsigned int _depth,
+                         const ImageOptions &_options) {
+    uint8_t *buffer = nullptr;
+    size_t size = 0;
+    std::vector<unsigned char> rgb;
+    if (_depth == 4 && isOpaque(_pixels, _width * _height)) {
+        // Without alpha WebP doesn't need to store an alpha plane
+        rgb.resize(_width * _height * 3);
+        rgbaToRgb(_pixels, _width * _height, rgb.data());
+        _pixels = rgb.data();
+        _depth = 3;
+    }
+    int stride = _width * _depth;
+
+    if (_options.quality >= 100) {
+        if (_depth == 4) {
+            size = WebPEncodeLosslessRGBA(_pixels, _width, _height, stride, &buffer);
+        } else {
+            size = WebPEncodeLosslessRGB(_pixels, _width, _height, stride, &buffer);
+        }
+    } else {
+        if (_depth == 4) {
+            size = WebPEncodeRGBA(_pixels, _width, _height, stride, _options.quality, &buffer);
+        } else {
+            size = WebPEncodeRGB(_pixels, _width, _height, stride, _options.quality, &buffer);
+        }
+    }
+
+    if (size == 0) {
+        free(buffer);
+        return false;
+    }
+
+    _out.append((const char*)buffer, size);
+    free(buffer);
+    return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "image_encoder.h"
+
+// libwebp backend, lossy with the requested quality or lossless at 100
+class WebpEncoder : public ImageEncoder {
+public:
+    const char* getMime() const override { return "image/webp"; }
+
+    bool encode(std::string &_out, const unsigned char *_pixels,
+                unsigned int _width, unsigned int _height, unsigned int _depth,
+                const ImageOptions &_options) override;
+};
@@ -0,0 +1,130 @@
+#include "test.h"
+#include "tools/disk_cache.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Every file under _path, one folder deep like the cache lays them out
+static int countFiles(const std::string &_path) {
+    int count = 0;
+    DIR *root = opendir(_path.c_str());
+    if (!root) {
+        return 0;
+    }
+    struct dirent *folder;
+    while ((folder = readdir(root)) != NULL) {
+        if (folder->d_name[0] == '.') {
+            continue;
+        }
+        DIR *dir = opendir((_path + "/" + folder->d_name).c_str());
+        if (!dir) {
+            continue;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            count += entry->d_name[0] != '.';
+        }
+        closedir(dir);
+    }
+    closedir(root);
+    return count;
+}
+
+static void removeAll(const std::string &_path) {
+    std::string command = "rm -rf '" + _path + "'";
+    CHECK(system(command.c_str()) == 0);
+}
+
+static void testGetPut(const std::string &_path) {
+    DiskCache cache(_path, 1024 * 1024);
+    std::string value;
+    CHECK(!cache.get("http://a/1/2/3.mvt", value));
+
+    CHECK(cache.put("http://a/1/2/3.mvt", std::string("tile\0data", 9)));
+    CHECK(cache.get("http://a/1/2/3.mvt", value));
+    CHECK(value == std::string("tile\0data", 9));
+
+    std::vector<char> bytes;
+    CHECK(cache.get("http://a/1/2/3.mvt", bytes));
+    CHECK(std::string(bytes.begin(), bytes.end()) == value);
+
+    // Overwritten in place
+    CHECK(cache.put("http://a/1/2/3.mvt", "other"));
+    CHECK(cache.get("http://a/1/2/3.mvt", value) && value == "other");
+
+    // Empty values are values too
+    CHECK(cache.put("empty", ""));
+    CHECK(cache.get("empty", value) && value.empty());
+}
+
+static void testShared(const std::string &_path) {
+    // Another worker of the host sees the same entries
+    DiskCache writer(_path, 1024 * 1024);
+    DiskCache reader(_path + "/", 1024 * 1024);
+    CHECK(writer.put("shared", "value"));
+
+    std::string value;
+    CHECK(reader.get("shared", value) && value == "value");
+}
+
+static void testTrim(const std::string &_path) {
+    // Ten entries of 200 bytes in a 1000 bytes cache
+    DiskCache cache(_path, 1000);
+    std::string data(200, 'x');
+    for (int i = 0; i < 10; i++) {
+        CHECK(cache.put("key" + std::to_string(i), data));
+    }
+    cache.trim();
+
+    // Below 90% of the size once trimmed, and what is left is still readable
+    int left = countFiles(_path);
+    CHECK(left > 0 && left < 5);
+    int found = 0;
+    std::string value;
+    for (int i = 0; i < 10; i++) {
+        if (cache.get("key" + std::to_string(i), value)) {
+            CHECK(value == data);
+            found++;
+        }
+    }
+    CHECK(found == left);
+}
+
+static void testBackgroundTrim(const std::string &_path) {
+    // Writing past the size doesn't trim on the writer, but soon after
+    DiskCache cache(_path, 1000);
+    std::string data(200, 'x');
+    for (int i = 0; i < 10; i++) {
+        CHECK(cache.put("key" + std::to_string(i), data));
+    }
+
+    int left = countFiles(_path);
+    for (int i = 0; i < 500 && left >= 5; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        left = countFiles(_path);
+    }
+    CHECK(left > 0 && left < 5);
+}
+
+int main() {
+    char dir[] = "/tmp/paparazzi_test_XXXXXX";
+    if (!mkdtemp(dir)) {
+        return EXIT_FAILURE;
+    }
+    std::string path(dir);
+
+    testGetPut(path + "/get_put");
+    testShared(path + "/shared");
+    testTrim(path + "/trim");
+    testBackgroundTrim(path + "/background_trim");
+
+    removeAll(path);
+    return TEST_RESULT();
+}
@@ -0,0 +1,40 @@
+#include "test.h"
+#include "tools/hash.h"
+
+#include <string>
+
+static std::string sha256(const std::string &_data) {
+    return sha256Hex(_data.data(), _data.size());
+}
+
+static void testSha256() {
+    // FIPS 180-2 examples
+    CHECK(sha256("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    CHECK(sha256("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    CHECK(sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    CHECK(sha256(std::string(1000000, 'a')) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+    // Lengths around the padding: the length field fits (55), barely doesn't (56) and a full block (64)
+    CHECK(sha256(std::string(55, 'x')) == "d5e285683cd4efc02d021a5c62014694958901005d6f71e89e0989fac77e4072");
+    CHECK(sha256(std::string(56, 'a')) == "b35439a4ac6f0948b6d6f9e3c6af0f5f590ce20f1bde7090ef7970686ec6738a");
+    CHECK(sha256(std::string(64, 'y')) == "ffbf30ab94107b2c14d75cfb455ec94f200400ddc5ce304e0c21894090db055f");
+    CHECK(sha256(std::string(1000, 'a')) == "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3");
+
+    // Binary data, zeros included
+    CHECK(sha256(std::string("\0\0\0", 3)) == "709e80c88487a2411e1ee4dfb9f22a861492d20c4765150c0c794abd70f8147c");
+}
+
+static void testHash64() {
+    // FNV-1a 64 reference values
+    CHECK(hash64("") == 0xcbf29ce484222325ULL);
+    CHECK(hash64("a") == 0xaf63dc4c8601ec8cULL);
+    CHECK(hash64("foobar") == 0x85944171f73967e8ULL);
+    CHECK(toHex(0x0123456789abcdefULL) == "0123456789abcdef");
+}
+
+int main() {
+    testSha256();
+    testHash64();
+    return TEST_RESULT();
+}
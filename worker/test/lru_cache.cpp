@@ -0,0 +1,66 @@
+#include "test.h"
+#include "tools/lru_cache.h"
+
+static void testGetPut() {
+    LruCache<int> cache(10);
+    int value = 0;
+    CHECK(!cache.get("a", value));
+
+    cache.put("a", 1, 4);
+    CHECK(cache.has("a"));
+    CHECK(cache.get("a", value) && value == 1);
+    CHECK(cache.getSize() == 4);
+
+    // Replacing a key replaces its size too
+    cache.put("a", 2, 6);
+    CHECK(cache.get("a", value) && value == 2);
+    CHECK(cache.getSize() == 6);
+    CHECK(cache.getCount() == 1);
+
+    cache.erase("a");
+    CHECK(!cache.has("a"));
+    CHECK(cache.getSize() == 0);
+}
+
+static void testEviction() {
+    LruCache<int> cache(10);
+    cache.put("a", 1, 4);
+    cache.put("b", 2, 4);
+
+    // A hit makes "a" the most recently used, so "b" goes first
+    int value;
+    CHECK(cache.get("a", value));
+    cache.put("c", 3, 4);
+    CHECK(cache.has("a"));
+    CHECK(!cache.has("b"));
+    CHECK(cache.has("c"));
+    CHECK(cache.getSize() == 8);
+
+    // Bigger than the whole cache: not kept, nothing evicted
+    cache.put("d", 4, 11);
+    CHECK(!cache.has("d"));
+    CHECK(cache.getCount() == 2);
+
+    // The whole cache at once evicts everything else
+    cache.put("e", 5, 10);
+    CHECK(cache.has("e"));
+    CHECK(cache.getCount() == 1);
+}
+
+static void testForEach() {
+    LruCache<int> cache(100);
+    cache.put("a", 1, 1);
+    cache.put("b", 2, 1);
+    cache.put("c", 3, 1);
+
+    std::string order;
+    cache.forEach([&order](const std::string &_key, const int &_value) { order += _key; });
+    CHECK(order == "cba");
+}
+
+int main() {
+    testGetPut();
+    testEviction();
+    testForEach();
+    return TEST_RESULT();
+}
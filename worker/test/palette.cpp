@@ -0,0 +1,88 @@
+#include "test.h"
+#include "tools/palette.h"
+#include "tools/png_encoder.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+// _colors distinct colors, each repeated over the image in a scattered order
+static std::vector<unsigned char> makeImage(unsigned int _count, unsigned int _colors) {
+    std::vector<unsigned char> pixels(_count * 4);
+    for (unsigned int i = 0; i < _count; i++) {
+        unsigned int color = (i * 7919) % _colors;
+        pixels[i * 4 + 0] = color & 0xff;
+        pixels[i * 4 + 1] = color >> 8;
+        pixels[i * 4 + 2] = 0x55;
+        pixels[i * 4 + 3] = color % 3 ? 255 : 128;
+    }
+    return pixels;
+}
+
+static unsigned int getColorType(const std::string &_png) {
+    // signature, IHDR length and type, width, height, bit depth, then the color type
+    return _png.size() > 25 ? (unsigned char)_png[25] : 0;
+}
+
+static void testExactPalette() {
+    const unsigned int count = 4096;
+    for (unsigned int colors : {1u, 2u, 17u, 255u, 256u}) {
+        std::vector<unsigned char> pixels = makeImage(count, colors);
+        std::vector<uint32_t> palette;
+        std::vector<unsigned char> indices;
+        CHECK(getExactPalette(pixels.data(), count, palette, indices));
+        CHECK(palette.size() == colors);
+        CHECK(indices.size() == count);
+
+        // every pixel comes back from its index
+        bool same = indices.size() == count;
+        for (unsigned int i = 0; i < count && same; i++) {
+            same = indices[i] < palette.size() && !memcmp(&palette[indices[i]], &pixels[i * 4], 4);
+        }
+        CHECK(same);
+    }
+}
+
+static void testTooManyColors() {
+    const unsigned int count = 4096;
+    std::vector<uint32_t> palette;
+    std::vector<unsigned char> indices;
+
+    std::vector<unsigned char> pixels = makeImage(count, 257);
+    CHECK(!getExactPalette(pixels.data(), count, palette, indices));
+
+    // the 257th color in the very last pixel
+    pixels = makeImage(count, 256);
+    pixels[(count - 1) * 4 + 2] = 0xaa;
+    CHECK(!getExactPalette(pixels.data(), count, palette, indices));
+
+    // a lower limit
+    pixels = makeImage(count, 17);
+    CHECK(!getExactPalette(pixels.data(), count, palette, indices, 16));
+    CHECK(getExactPalette(pixels.data(), count, palette, indices, 17));
+}
+
+static void testPng8() {
+    const unsigned int width = 64, height = 64;
+    ImageOptions options;
+    Png8Encoder encoder;
+
+    // fits a palette: indexed color
+    std::string png;
+    std::vector<unsigned char> pixels = makeImage(width * height, 256);
+    CHECK(encoder.encode(png, pixels.data(), width, height, 4, options));
+    CHECK(getColorType(png) == 3);
+
+    // one color too many: falls back to truecolor with alpha
+    png.clear();
+    pixels = makeImage(width * height, 257);
+    CHECK(encoder.encode(png, pixels.data(), width, height, 4, options));
+    CHECK(getColorType(png) == 6);
+}
+
+int main() {
+    testExactPalette();
+    testTooManyColors();
+    testPng8();
+    return TEST_RESULT();
+}
@@ -0,0 +1,63 @@
+#include "test.h"
+#include "tools/pixels.h"
+
+#include <vector>
+
+// Widths that are not a multiple of the SIMD steps, so the scalar tails run too
+static const unsigned int MAX_COUNT = 67;
+static const unsigned int GUARD = 16;
+
+static std::vector<unsigned char> makePixels(unsigned int _count) {
+    std::vector<unsigned char> pixels(_count * 4);
+    for (unsigned int i = 0; i < pixels.size(); i++) {
+        pixels[i] = (i % 4 == 3) ? 255 : (unsigned char)(i * 31 + 7);
+    }
+    return pixels;
+}
+
+static void testIsOpaque() {
+    for (unsigned int count = 0; count <= MAX_COUNT; count++) {
+        std::vector<unsigned char> pixels = makePixels(count);
+        CHECK(isOpaque(pixels.data(), count));
+
+        // one translucent pixel at each position
+        for (unsigned int i = 0; i < count; i++) {
+            pixels[i * 4 + 3] = 254;
+            CHECK(!isOpaque(pixels.data(), count));
+            pixels[i * 4 + 3] = 255;
+        }
+
+        // but none past the end
+        pixels.resize((count + 1) * 4, 0);
+        CHECK(isOpaque(pixels.data(), count));
+    }
+}
+
+static void testRgbaToRgb() {
+    for (unsigned int count = 0; count <= MAX_COUNT; count++) {
+        std::vector<unsigned char> pixels = makePixels(count);
+        std::vector<unsigned char> rgb(count * 3 + GUARD, 0xcd);
+        rgbaToRgb(pixels.data(), count, rgb.data());
+
+        bool same = true;
+        for (unsigned int i = 0; i < count; i++) {
+            for (unsigned int c = 0; c < 3; c++) {
+                same = same && rgb[i * 3 + c] == pixels[i * 4 + c];
+            }
+        }
+        CHECK(same);
+
+        // nothing written past the last pixel
+        bool untouched = true;
+        for (unsigned int i = count * 3; i < rgb.size(); i++) {
+            untouched = untouched && rgb[i] == 0xcd;
+        }
+        CHECK(untouched);
+    }
+}
+
+int main() {
+    testIsOpaque();
+    testRgbaToRgb();
+    return TEST_RESULT();
+}
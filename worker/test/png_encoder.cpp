@@ -0,0 +1,168 @@
+#include "test.h"
+#include "tools/png_encoder.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+static uint32_t getUint32(const unsigned char *_data) {
+    return (uint32_t)_data[0] << 24 | (uint32_t)_data[1] << 16 | (uint32_t)_data[2] << 8 | _data[3];
+}
+
+static int paeth(int _a, int _b, int _c) {
+    int p = _a + _b - _c;
+    int pa = abs(p - _a), pb = abs(p - _b), pc = abs(p - _c);
+    if (pa <= pb && pa <= pc) return _a;
+    if (pb <= pc) return _b;
+    return _c;
+}
+
+// Minimal PNG reader: checks the signature and the CRCs, inflates the IDAT
+// chunks and undoes the filters. Returns the rows, or nothing on any error.
+static std::vector<unsigned char> decode(const std::string &_png, unsigned int &_width, unsigned int &_height, unsigned int &_type) {
+    static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    const unsigned char *data = (const unsigned char*)_png.data();
+    if (_png.size() < 8 || memcmp(data, signature, 8) != 0) {
+        return {};
+    }
+
+    std::string idat;
+    bool end = false;
+    for (size_t offset = 8; offset + 12 <= _png.size() && !end;) {
+        uint32_t size = getUint32(data + offset);
+        if (offset + 12 + size > _png.size()) {
+            return {};
+        }
+        const unsigned char *type = data + offset + 4;
+        const unsigned char *chunk = data + offset + 8;
+        if (crc32(crc32(0L, Z_NULL, 0), type, 4 + size) != getUint32(chunk + size)) {
+            return {};
+        }
+        if (!memcmp(type, "IHDR", 4)) {
+            _width = getUint32(chunk);
+            _height = getUint32(chunk + 4);
+            _type = chunk[9];
+        } else if (!memcmp(type, "IDAT", 4)) {
+            idat.append((const char*)chunk, size);
+        } else if (!memcmp(type, "IEND", 4)) {
+            end = true;
+        }
+        offset += 12 + size;
+    }
+    if (!end) {
+        return {};
+    }
+
+    unsigned int depth = _type == 6 ? 4 : _type == 2 ? 3 : 1;
+    size_t stride = _width * depth;
+    std::vector<unsigned char> filtered((stride + 1) * _height);
+    uLongf size = filtered.size();
+    if (uncompress(filtered.data(), &size, (const Bytef*)idat.data(), idat.size()) != Z_OK || size != filtered.size()) {
+        return {};
+    }
+
+    std::vector<unsigned char> rows(stride * _height);
+    for (unsigned int y = 0; y < _height; y++) {
+        const unsigned char *in = &filtered[y * (stride + 1)];
+        unsigned char *out = &rows[y * stride];
+        const unsigned char *prev = y > 0 ? out - stride : nullptr;
+        for (size_t x = 0; x < stride; x++) {
+            int a = x >= depth ? out[x - depth] : 0;
+            int b = prev ? prev[x] : 0;
+            int c = prev && x >= depth ? prev[x - depth] : 0;
+            switch (in[0]) {
+                case 0: out[x] = in[1 + x]; break;
+                case 1: out[x] = in[1 + x] + a; break;
+                case 2: out[x] = in[1 + x] + b; break;
+                case 3: out[x] = in[1 + x] + (a + b) / 2; break;
+                case 4: out[x] = in[1 + x] + paeth(a, b, c); break;
+                default: return {};
+            }
+        }
+    }
+    return rows;
+}
+
+// Noise over gradients, so every filter has something to do
+static std::vector<unsigned char> makeImage(unsigned int _width, unsigned int _height, unsigned int _depth) {
+    std::vector<unsigned char> pixels(_width * _height * _depth);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < pixels.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        pixels[i] = (unsigned char)((i % (_width * _depth)) + (seed >> 28));
+    }
+    return pixels;
+}
+
+static void testRoundTrip() {
+    const unsigned int width = 37, height = 23;
+    for (unsigned int depth : {3u, 4u}) {
+        std::vector<unsigned char> pixels = makeImage(width, height, depth);
+        for (unsigned int filter = PNG_FILTER_NONE; filter <= PNG_FILTER_AUTO; filter++) {
+            for (int compression : {0, 1, 6, 9}) {
+                std::string png;
+                PngWriter writer(png, width, height, depth, compression, filter);
+                CHECK(writer.writeRows(pixels.data(), height, width * depth) && writer.finish());
+
+                unsigned int w = 0, h = 0, type = 0;
+                std::vector<unsigned char> rows = decode(png, w, h, type);
+                CHECK(w == width && h == height);
+                CHECK(type == (depth == 4 ? 6u : 2u));
+                CHECK(rows == pixels);
+            }
+        }
+    }
+}
+
+static void testRowByRow() {
+    const unsigned int width = 16, height = 9;
+    std::vector<unsigned char> pixels = makeImage(width, height, 4);
+
+    std::string png;
+    PngWriter writer(png, width, height, 4, 6, PNG_FILTER_PAETH);
+    for (unsigned int y = 0; y < height; y++) {
+        CHECK(writer.writeRow(&pixels[y * width * 4]));
+    }
+    CHECK(writer.finish());
+
+    unsigned int w, h, type;
+    CHECK(decode(png, w, h, type) == pixels);
+
+    // Not every row written: no image
+    std::string partial;
+    PngWriter short_writer(partial, width, height, 4, 6, PNG_FILTER_UP);
+    short_writer.writeRow(pixels.data());
+    CHECK(!short_writer.finish());
+}
+
+static void testOpaque() {
+    // Opaque RGBA goes out as RGB, with the same colors
+    const unsigned int width = 20, height = 5;
+    std::vector<unsigned char> pixels = makeImage(width, height, 4);
+    for (size_t i = 3; i < pixels.size(); i += 4) {
+        pixels[i] = 255;
+    }
+
+    std::string png;
+    ImageOptions options;
+    PngEncoder encoder;
+    CHECK(encoder.encode(png, pixels.data(), width, height, 4, options));
+
+    unsigned int w, h, type;
+    std::vector<unsigned char> rows = decode(png, w, h, type);
+    CHECK(type == 2);
+    CHECK(rows.size() == width * height * 3);
+    for (size_t i = 0; i < width * height && rows.size() == width * height * 3; i++) {
+        CHECK(!memcmp(&rows[i * 3], &pixels[i * 4], 3));
+    }
+}
+
+int main() {
+    testRoundTrip();
+    testRowByRow();
+    testOpaque();
+    return TEST_RESULT();
+}
@@ -0,0 +1,149 @@
+#include "test.h"
+#include "request.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+static void parse(Request &_request, const std::string &_message) {
+    _request.parse(_message.data(), _message.size());
+}
+
+// The message of the std::invalid_argument thrown by parse(), empty if none
+static std::string error(const std::string &_message) {
+    Request request;
+    try {
+        parse(request, _message);
+    }
+    catch(const std::invalid_argument &e) {
+        return e.what();
+    }
+    return "";
+}
+
+static void testCheck() {
+    Request request;
+    parse(request, "GET /check HTTP/1.1\r\nHost: paparazzi\r\n\r\n");
+    CHECK(request.route == Request::ROUTE_CHECK);
+}
+
+static void testView() {
+    Request request;
+    parse(request, "GET /?scene=http%3A%2F%2Fexample.com%2Fscene.yaml&width=800&height=600&lat=40.7053&lon=-74.0098&zoom=16"
+                   "&tilt=30&rotation=-45&density=2&transparent=true&aa=msaa&width=1 HTTP/1.1\r\n\r\n");
+    CHECK(request.route == Request::ROUTE_VIEW);
+    CHECK(request.scene.str() == "http://example.com/scene.yaml");
+    // The first value of a repeated parameter wins
+    CHECK(request.width == 800);
+    CHECK(request.height == 600);
+    CHECK(request.lat == 40.7053);
+    CHECK(request.lon == -74.0098);
+    CHECK(request.zoom == 16.f);
+    CHECK(request.tilt == 30.f);
+    CHECK(request.rotation == -45.f);
+    CHECK(request.density == 2.f);
+    CHECK(request.transparent);
+    CHECK(request.aa == AA_MULTISAMPLE);
+    CHECK(request.body.empty());
+}
+
+static void testDefaults() {
+    Request request;
+    parse(request, "GET /?scene=a&width=1&height=1&lat=0&lon=0&zoom=0 HTTP/1.1\r\n\r\n");
+    CHECK(request.density == 1.f);
+    CHECK(request.tilt == 0.f);
+    CHECK(request.rotation == 0.f);
+    CHECK(request.aa == -1);
+    CHECK(!request.transparent);
+    CHECK(request.options.format == IMAGE_FORMAT_PNG);
+}
+
+static void testEncoding() {
+    Request request;
+    parse(request, "GET /?scene=a&width=1&height=1&lat=0&lon=0&zoom=0&format=jpg&quality=70&compression=9&filter=paeth HTTP/1.1\r\n\r\n");
+    CHECK(request.options.format == IMAGE_FORMAT_JPEG);
+    CHECK(request.options.quality == 70);
+    CHECK(request.options.compression == 9);
+    CHECK(request.options.filter == PNG_FILTER_PAETH);
+}
+
+static void testTile() {
+    Request request;
+    parse(request, "GET /tiles/3/2/7.png8?scene=a&transparent=0 HTTP/1.1\r\n\r\n");
+    CHECK(request.route == Request::ROUTE_TILE);
+    CHECK(request.tile_z == 3);
+    CHECK(request.tile_x == 2);
+    CHECK(request.tile_y == 7);
+    CHECK(request.options.format == IMAGE_FORMAT_PNG8);
+    CHECK(!request.transparent);
+
+    // A full view wins over the tile path
+    Request view;
+    parse(view, "GET /3/2/7.png?scene=a&width=1&height=1&lat=0&lon=0&zoom=0 HTTP/1.1\r\n\r\n");
+    CHECK(view.route == Request::ROUTE_VIEW);
+}
+
+static void testPost() {
+    Request request;
+    parse(request, "POST /?width=1&height=1&lat=0&lon=0&zoom=0 HTTP/1.1\r\nContent-Length: 11\r\n\r\nscene: yaml");
+    CHECK(request.scene.empty());
+    CHECK(request.body.str() == "scene: yaml");
+
+    Request batch;
+    parse(batch, "POST /batch?scene=a&format=webp HTTP/1.1\r\n\r\n[{}]");
+    CHECK(batch.route == Request::ROUTE_BATCH);
+    CHECK(batch.options.format == IMAGE_FORMAT_WEBP);
+    CHECK(batch.body.str() == "[{}]");
+
+    // The views of a batch only come in a body
+    for (const char* method : {"GET", "PUT", "POSTS", "OPTIONS"}) {
+        Request other;
+        bool not_allowed = false;
+        try {
+            parse(other, std::string(method) + " /batch?scene=a HTTP/1.1\r\n\r\n[{}]");
+        }
+        catch(const MethodNotAllowed& e) {
+            not_allowed = std::string(e.allow) == "POST";
+        }
+        CHECK(not_allowed);
+    }
+}
+
+static void testErrors() {
+    CHECK(error("GARBAGE") == "bad request line");
+    CHECK(error("GET /?scene=a&width=10 HTTP/1.1\r\n\r\n") == "height is required (or a /{z}/{x}/{y}.png tile path)");
+    CHECK(error("GET /?scene=a&width=abc&height=1&lat=0&lon=0&zoom=0 HTTP/1.1\r\n\r\n").find("width must be an integer") == 0);
+    CHECK(error("GET /?scene=a&width=1&height=1&lat=91&lon=0&zoom=0 HTTP/1.1\r\n\r\n").find("lat must be a number") == 0);
+    CHECK(error("GET /?scene=a&width=1&height=1&lat=0&lon=0&zoom=nan HTTP/1.1\r\n\r\n").find("zoom must be a number") == 0);
+    CHECK(error("GET /?scene=a&width=1&height=1&lat=0&lon=0&zoom=0&density=9 HTTP/1.1\r\n\r\n").find("density must be a number") == 0);
+    CHECK(error("GET /?scene=a&width=1&height=1&lat=0&lon=0&zoom=0&format=bmp HTTP/1.1\r\n\r\n").find("format must be") == 0);
+    CHECK(error("GET /?scene=a&width=1&height=1&lat=0&lon=0&zoom=0&aa=fxaa HTTP/1.1\r\n\r\n").find("aa must be") == 0);
+    CHECK(error("GET /1/2/0.png?scene=a HTTP/1.1\r\n\r\n") == "tile out of range");
+    CHECK(error("GET /1/1/1.png?scene=%zz HTTP/1.1\r\n\r\n") == "bad value for scene");
+
+    // Too long for the scene buffer
+    CHECK(error("GET /1/1/1.png?scene=" + std::string(MAX_SCENE_URL + 1, 'a') + " HTTP/1.1\r\n\r\n") == "bad value for scene");
+}
+
+static void testViewValues() {
+    CHECK(Request::checkViewValue("width", 512.) == 512.);
+    CHECK(Request::checkViewValue("lat", -45.5) == -45.5);
+    CHECK_THROWS(Request::checkViewValue("width", 0.5));
+    CHECK_THROWS(Request::checkViewValue("width", 1e300));
+    CHECK_THROWS(Request::checkViewValue("zoom", 31.));
+    CHECK_THROWS(Request::checkViewValue("density", 0.));
+    CHECK_THROWS(Request::checkViewValue("tilt", NAN));
+}
+
+int main() {
+    testCheck();
+    testView();
+    testDefaults();
+    testEncoding();
+    testTile();
+    testPost();
+    testErrors();
+    testViewValues();
+    return TEST_RESULT();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Bare bones checks for the unit tests: every failed check is printed and
+// the test exits with EXIT_FAILURE if there was any (see TEST_RESULT)
+static int test_failures = 0;
+
+#define CHECK(_condition) do { \
+    if (!(_condition)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #_condition); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_THROWS(_statement) do { \
+    bool thrown = false; \
+    try { _statement; } catch (...) { thrown = true; } \
+    if (!thrown) { \
+        fprintf(stderr, "%s:%d: %s didn't throw\n", __FILE__, __LINE__, #_statement); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE)